@@ -0,0 +1,147 @@
+/*
+ * bulk rb_puts/rb_gets throughput, and what it costs a thread whose working set
+ * should stay in cache, with plain memcpy and with the non-temporal copy engine
+ *
+ * gcc -O2 -o bench_copy bench_copy.c ringbuffer.c rbcopy.c -lpthread
+ * ./bench_copy [chunk_kb] [working_set_kb] [seconds]
+ */
+
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define RB_SIZE         (64 << 20)
+#define LINE            64
+
+static volatile int stopping;
+static volatile size_t sink;
+static unsigned int chunk = 8 << 20;
+static unsigned int ws = 512 << 10;
+static double seconds = 3;
+
+struct result {
+    double gbps;
+    double ns;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *copier(void *ptr)
+{
+    struct result *res = (struct result *)ptr;
+    unsigned char *src, *dst;
+    unsigned long long bytes = 0;
+    rb_t *rb;
+    double start;
+
+    rb_init(&rb, RB_SIZE);
+    src = (unsigned char *)malloc(chunk);
+    dst = (unsigned char *)malloc(chunk);
+    memset(src, 'C', chunk);
+    memset(dst, 0, chunk);
+    start = now();
+    while (!stopping) {
+        rb_puts(rb, src, chunk);
+        bytes += rb_gets(rb, dst, chunk);
+    }
+    res->gbps = bytes / (now() - start) / 1e9;
+    free(src);
+    free(dst);
+    rb_deinit(rb);
+
+    return NULL;
+}
+
+/* random pointer chase over the working set, one cache line per hop */
+static void *victim(void *ptr)
+{
+    struct result *res = (struct result *)ptr;
+    size_t *lines, n, i, j, t, p = 0;
+    unsigned long long hops = 0;
+    double start;
+
+    n = ws / LINE;
+    lines = (size_t *)aligned_alloc(LINE, n * LINE);
+    for (i = 0; i < n; i++)
+        lines[i * (LINE / sizeof(size_t))] = i;
+    srand(1);
+    for (i = n - 1; i > 0; i--) {
+        j = (size_t)rand() % i;
+        t = lines[i * (LINE / sizeof(size_t))];
+        lines[i * (LINE / sizeof(size_t))] = lines[j * (LINE / sizeof(size_t))];
+        lines[j * (LINE / sizeof(size_t))] = t;
+    }
+    start = now();
+    while (!stopping) {
+        for (i = 0; i < 4096; i++)
+            p = lines[p * (LINE / sizeof(size_t))];
+        hops += 4096;
+    }
+    res->ns = (now() - start) * 1e9 / hops;
+    sink = p;
+    free(lines);
+
+    return NULL;
+}
+
+static void run(const char *name, size_t threshold, int with_copier, int with_victim)
+{
+    pthread_t c, v;
+    struct result cr = { 0, 0 }, vr = { 0, 0 };
+    struct timespec ts;
+
+    rb_set_copy_threshold(threshold);
+    stopping = 0;
+    if (with_copier)
+        pthread_create(&c, NULL, copier, &cr);
+    if (with_victim)
+        pthread_create(&v, NULL, victim, &vr);
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    stopping = 1;
+    if (with_copier)
+        pthread_join(c, NULL);
+    if (with_victim)
+        pthread_join(v, NULL);
+    printf("%-22s", name);
+    if (with_copier)
+        printf("  copy %7.2f GB/s", cr.gbps);
+    else
+        printf("  %-17s", "");
+    if (with_victim)
+        printf("  victim %6.2f ns/line", vr.ns);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        chunk = atoi(argv[1]) << 10;
+    if (argc > 2)
+        ws = atoi(argv[2]) << 10;
+    if (argc > 3)
+        seconds = atof(argv[3]);
+    if (!chunk || chunk > RB_SIZE || ws < LINE) {
+        fprintf(stderr, "chunk must be 1..%d KB\n", RB_SIZE >> 10);
+        return 1;
+    }
+
+    printf("engine %s, chunk %u KB, working set %u KB\n", rb_copy_engine(), chunk >> 10, ws >> 10);
+    run("victim alone", 0, 0, 1);
+    run("memcpy alone", 0, 1, 0);
+    run("streaming alone", RB_COPY_THRESHOLD, 1, 0);
+    run("memcpy + victim", 0, 1, 1);
+    run("streaming + victim", RB_COPY_THRESHOLD, 1, 1);
+
+    return 0;
+}
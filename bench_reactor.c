@@ -0,0 +1,212 @@
+/*
+ * loopback echo throughput over rbreactor_t
+ *
+ * gcc -O2 -o bench_reactor bench_reactor.c rbreactor.c ringbuffer.c rbcopy.c -lpthread
+ * ./bench_reactor [conns] [msg_size] [seconds] [rb|rbvec]
+ */
+
+#include "rbreactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define BUF_SIZE        16384
+#define VEC_MAX_NUM     8
+#define VEC_ELE_SIZE    4096
+#define MAX_EVENTS      1024
+
+static int use_rbvec;
+static unsigned int msg_size = 64;
+static volatile int stopping;
+static unsigned long long msgs;
+static unsigned char *msg;
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add(rbreactor_t *r, int fd, rbconn_pt read_cb, rbconn_t **conn)
+{
+    if (use_rbvec)
+        return rbreactor_addv(r, fd, VEC_MAX_NUM, VEC_ELE_SIZE, read_cb, NULL, NULL, conn);
+    return rbreactor_add(r, fd, BUF_SIZE, BUF_SIZE, read_cb, NULL, NULL, conn);
+}
+
+/* server: move everything from the read buffer to the write buffer */
+static void echo_read(rbconn_t *c)
+{
+    unsigned char buf[BUF_SIZE];
+    unsigned int s;
+
+    for (;;) {
+        if (c->type == RBCONN_RB)
+            s = rb_gets(c->rbuf.rb, buf, sizeof(buf));
+        else
+            s = rbvec_gets(c->rbuf.rbv, buf, sizeof(buf));
+        if (!s)
+            break;
+        rbreactor_puts(c, buf, s);
+    }
+}
+
+static void echo_accept(rbreactor_t *r, int fd, void *data)
+{
+    int one = 1;
+
+    (void)data;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (add(r, fd, echo_read, NULL) < 0)
+        close(fd);
+}
+
+/* client: one message in flight per connection */
+static void client_read(rbconn_t *c)
+{
+    unsigned char buf[BUF_SIZE];
+
+    while (rbconn_used_size(c, rbuf) >= msg_size) {
+        if (c->type == RBCONN_RB)
+            rb_gets(c->rbuf.rb, buf, msg_size);
+        else
+            rbvec_gets(c->rbuf.rbv, buf, msg_size);
+        msgs++;
+        if (!stopping)
+            rbreactor_puts(c, msg, msg_size);
+    }
+}
+
+static void *server_main(void *ptr)
+{
+    rbreactor_t *r = (rbreactor_t *)ptr;
+
+    while (!stopping)
+        rbreactor_poll(r, 100);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    rbreactor_t *server, *client;
+    rbconn_t **conns;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct rlimit rl;
+    pthread_t tid;
+    unsigned int nconns = 10000, seconds = 5, i;
+    unsigned long long polls = 0, events = 0;
+    int lfd, one = 1, rv;
+    double start, elapsed;
+
+    if (argc > 1)
+        nconns = atoi(argv[1]);
+    if (argc > 2)
+        msg_size = atoi(argv[2]);
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+    if (argc > 4)
+        use_rbvec = strcmp(argv[4], "rbvec") == 0;
+    if (!msg_size || msg_size > BUF_SIZE) {
+        fprintf(stderr, "msg_size must be 1..%d\n", BUF_SIZE);
+        return 1;
+    }
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < nconns * 2 + 64) {
+        rl.rlim_cur = rl.rlim_max < nconns * 2 + 64 ? rl.rlim_max : nconns * 2 + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < nconns * 2 + 64) {
+            nconns = (rl.rlim_cur - 64) / 2;
+            fprintf(stderr, "RLIMIT_NOFILE too low, using %u connections\n", nconns);
+        }
+    }
+
+    msg = (unsigned char *)malloc(msg_size);
+    memset(msg, 'E', msg_size);
+    conns = (rbconn_t **)calloc(nconns, sizeof(*conns));
+
+    lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 4096) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    getsockname(lfd, (struct sockaddr *)&addr, &addrlen);
+
+    rv = rbreactor_init(&server, MAX_EVENTS);
+    rv |= rbreactor_init(&client, MAX_EVENTS);
+    rv |= rbreactor_listen(server, lfd, echo_accept, NULL, NULL);
+    if (rv) {
+        fprintf(stderr, "rbreactor_init failed\n");
+        return 1;
+    }
+    pthread_create(&tid, NULL, server_main, server);
+
+    for (i = 0; i < nconns; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            if (fd >= 0)
+                close(fd);
+            nconns = i;
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (add(client, fd, client_read, &conns[i]) < 0) {
+            close(fd);
+            nconns = i;
+            break;
+        }
+    }
+
+    start = now();
+    for (i = 0; i < nconns; i++)
+        rbreactor_puts(conns[i], msg, msg_size);
+    while ((elapsed = now() - start) < seconds) {
+        rv = rbreactor_poll(client, 100);
+        if (rv < 0)
+            break;
+        polls++;
+        events += rv;
+    }
+    stopping = 1;
+    pthread_join(tid, NULL);
+
+    printf("%s conns %u msg %u: %.0f msgs/s, %.1f MB/s, %.1f events/epoll_wait\n",
+        use_rbvec ? "rbvec" : "rb",
+        nconns,
+        msg_size,
+        msgs / elapsed,
+        msgs * msg_size * 2 / elapsed / 1e6,
+        polls ? (double)events / polls : 0.0);
+
+    for (i = 0; i < nconns; i++)
+        rbreactor_close(conns[i]);
+    rbreactor_poll(client, 0);
+    rbreactor_deinit(client);
+    rbreactor_deinit(server);
+    close(lfd);
+    free(conns);
+    free(msg);
+
+    return 0;
+}
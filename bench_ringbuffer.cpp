@@ -0,0 +1,91 @@
+/*
+ * rb::byte_ring<N> against the C rb_t API
+ *
+ * gcc -O2 -c ringbuffer.c rbcopy.c && g++ -std=c++20 -O2 -o bench_ringbuffer bench_ringbuffer.cpp ringbuffer.o rbcopy.o
+ * ./bench_ringbuffer [total_mb]
+ */
+
+#include "ringbuffer.h"
+#include "ringbuffer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#define RING_SIZE       65536
+
+static volatile unsigned char sink;
+
+template <typename F>
+static double run(unsigned long long total, F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f(total);
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return total / d.count() / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int chunks[] = { 16, 64, 256, 1500, 16384 };
+    unsigned long long total = 1ULL << 30;
+    unsigned char src[16384], dst[16384];
+    auto ring = std::make_unique<rb::byte_ring<RING_SIZE>>();
+    rb_t *crb;
+
+    if (argc > 1)
+        total = strtoull(argv[1], NULL, 10) << 20;
+    memset(src, 'C', sizeof(src));
+    if (rb_init(&crb, RING_SIZE) < 0)
+        return 1;
+
+    /* copies in GB/s, peek/produced/consumed round trips in millions per second */
+    printf("%8s %14s %14s %16s %16s\n", "chunk", "rb_puts/gets", "byte_ring", "rb_peek", "byte_ring peek");
+    for (unsigned int chunk : chunks) {
+        double c_copy, cpp_copy, c_peek, cpp_peek;
+
+        c_copy = run(total, [&](unsigned long long n) {
+            for (unsigned long long i = 0; i < n; i += chunk) {
+                rb_puts(crb, src, chunk);
+                rb_gets(crb, dst, chunk);
+            }
+            sink = dst[0];
+        });
+        cpp_copy = run(total, [&](unsigned long long n) {
+            for (unsigned long long i = 0; i < n; i += chunk) {
+                ring->puts(src, chunk);
+                ring->gets(dst, chunk);
+            }
+            sink = dst[0];
+        });
+        c_peek = run(total, [&](unsigned long long n) {
+            unsigned char *buf;
+            unsigned int s;
+
+            for (unsigned long long i = 0; i < n; i += chunk) {
+                s = rb_producer_peek(crb, chunk, &buf);
+                buf[0] = (unsigned char)i;
+                rb_produced(crb, s);
+                s = rb_consumer_peek(crb, chunk, &buf);
+                sink = buf[0];
+                rb_consumed(crb, s);
+            }
+        });
+        cpp_peek = run(total, [&](unsigned long long n) {
+            for (unsigned long long i = 0; i < n; i += chunk) {
+                auto w = ring->producer_peek(chunk);
+                w.first[0] = (unsigned char)i;
+                ring->produced(w.first.size());
+                auto r = ring->consumer_peek(chunk);
+                sink = r.first[0];
+                ring->consumed(r.first.size());
+            }
+        });
+        printf("%8u %9.2f GB/s %9.2f GB/s %10.1f Mops/s %10.1f Mops/s\n",
+            chunk, c_copy, cpp_copy, c_peek * 1e3 / chunk, cpp_peek * 1e3 / chunk);
+    }
+    rb_deinit(crb);
+
+    return 0;
+}
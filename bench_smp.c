@@ -0,0 +1,920 @@
+/*
+ * one producer and one consumer thread per rb_t, pinned to given cores:
+ * random sized rb_smp_producer_peek/rb_smp_produced and
+ * rb_smp_consumer_peek/rb_smp_consumed cycles carry a stream of 64 bit
+ * sequence numbers that the consumer checks, then a ping-pong over a pair
+ * of rings measures the one way cross-core latency
+ *
+ * groups of producers and consumers go through rbmp_t (reserve/commit),
+ * rbshard_t or rbev_t instead: every message carries its producer, a send
+ * time stamp and that producer's sequence numbers, the consumers check them
+ * per producer and the stamps give the one way latency
+ *
+ * gcc -O2 -o bench_smp bench_smp.c ringbuffer.c rbcopy.c rbmp.c rbshard.c rbev.c -lpthread
+ * ./bench_smp [seconds] [rb_kb] [max_chunk] [p:c[,p:c...] | mp:p[+p...]:c | shard:p[+p...]:c[+c...] | ev:p:c ...]
+ */
+
+#define _GNU_SOURCE
+#include "ringbuffer.h"
+#include "rbmp.h"
+#include "rbshard.h"
+#include "rbev.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#define MAX_PAIRS       64
+#define MAX_GROUP       64          /* producers or consumers of a group */
+#define PINGS           100000
+#define SAMPLES         65536       /* latency samples kept per consumer, the latest ones */
+#define WORD            sizeof(uint64_t)
+#define SEQ_MASK        ((1ULL << 48) - 1)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()     __builtin_ia32_pause()
+#else
+#define cpu_relax()     do {} while (0)
+#endif
+
+struct pair {
+    int pcpu;
+    int ccpu;
+    rb_t *rb;
+    rb_t *back;                 /* ping-pong reply ring */
+    unsigned long long consumed;        /* words */
+    unsigned long long pops;
+    unsigned long long puts;
+    unsigned long long errors;
+    unsigned long long final;   /* words the producer wrote, valid once done */
+    int done;
+    unsigned int *rtt;
+    pthread_t ptid;
+    pthread_t ctid;
+    int pstarted;
+    int cstarted;
+};
+
+static struct pair pairs[MAX_PAIRS];
+static unsigned int npairs;
+static double seconds = 2;
+static unsigned int rb_size = 64 << 10;
+static unsigned int max_chunk = 4096;
+static int stopping;
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int xorshift(unsigned int *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/* whole words between WORD and max_chunk */
+static unsigned int chunk(unsigned int *s)
+{
+    return (xorshift(s) % (max_chunk / WORD) + 1) * WORD;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "cannot pin to cpu %d, running unpinned\n", cpu);
+}
+
+static void backoff(unsigned int *spins)
+{
+    if (++*spins & 1023)
+        cpu_relax();
+    else
+        sched_yield();
+}
+
+/* 0 once the run is called off, a ping-pong partner may never have started */
+static int keep_waiting(unsigned int *spins)
+{
+    if (__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+        return 0;
+    backoff(spins);
+
+    return 1;
+}
+
+/* stopping tells the threads already started to give up */
+static int spawn(pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+    int rv;
+
+    rv = pthread_create(tid, NULL, fn, arg);
+    if (rv) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *producer(void *ptr)
+{
+    struct pair *p = (struct pair *)ptr;
+    unsigned long long seq = 0;
+    unsigned int seed = 2463534242u + p->pcpu, spins = 0, n, want, i;
+    unsigned char *buf;
+    uint64_t w;
+
+    pin(p->pcpu);
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        want = chunk(&seed);
+        n = rb_smp_producer_peek(p->rb, want, &buf);
+        if (!n) {
+            backoff(&spins);
+            continue;
+        }
+        for (i = 0; i < n; i += WORD) {
+            w = seq++;
+            memcpy(buf + i, &w, WORD);
+        }
+        rb_smp_produced(p->rb, n);
+        p->puts++;
+    }
+    p->final = seq;
+    __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static void *consumer(void *ptr)
+{
+    struct pair *p = (struct pair *)ptr;
+    unsigned long long seq = 0;
+    unsigned int seed = 88675123u + p->ccpu, spins = 0, n, want, i;
+    unsigned char *buf;
+    uint64_t w;
+
+    pin(p->ccpu);
+    for (;;) {
+        want = chunk(&seed);
+        n = rb_smp_consumer_peek(p->rb, want, &buf);
+        if (!n) {
+            if (__atomic_load_n(&p->done, __ATOMIC_ACQUIRE) && rb_smp_in(p->rb) == p->rb->out)
+                break;
+            backoff(&spins);
+            continue;
+        }
+        for (i = 0; i < n; i += WORD) {
+            memcpy(&w, buf + i, WORD);
+            if (w != seq)
+                p->errors++;
+            seq++;
+        }
+        rb_smp_consumed(p->rb, n);
+        p->pops++;
+    }
+    p->consumed = seq;
+    if (seq != p->final)
+        p->errors++;
+
+    return NULL;
+}
+
+/* the initiator sends a word, the other side echoes it back */
+static void *pinger(void *ptr)
+{
+    struct pair *p = (struct pair *)ptr;
+    unsigned long long t;
+    unsigned int i, spins = 0;
+    unsigned char *buf;
+    uint64_t w;
+
+    pin(p->pcpu);
+    for (i = 0; i < PINGS; i++) {
+        t = now_ns();
+        w = i;
+        while (rb_smp_producer_peek(p->rb, WORD, &buf) < WORD)
+            if (!keep_waiting(&spins))
+                return NULL;
+        memcpy(buf, &w, WORD);
+        rb_smp_produced(p->rb, WORD);
+        while (rb_smp_consumer_peek(p->back, WORD, &buf) < WORD)
+            if (!keep_waiting(&spins))
+                return NULL;
+        memcpy(&w, buf, WORD);
+        rb_smp_consumed(p->back, WORD);
+        if (w != i)
+            p->errors++;
+        p->rtt[i] = (unsigned int)(now_ns() - t);
+    }
+
+    return NULL;
+}
+
+static void *ponger(void *ptr)
+{
+    struct pair *p = (struct pair *)ptr;
+    unsigned char *in, *out;
+    unsigned int i, spins = 0;
+
+    pin(p->ccpu);
+    for (i = 0; i < PINGS; i++) {
+        while (rb_smp_consumer_peek(p->rb, WORD, &in) < WORD)
+            if (!keep_waiting(&spins))
+                return NULL;
+        while (rb_smp_producer_peek(p->back, WORD, &out) < WORD)
+            if (!keep_waiting(&spins))
+                return NULL;
+        memcpy(out, in, WORD);
+        rb_smp_consumed(p->rb, WORD);
+        rb_smp_produced(p->back, WORD);
+    }
+
+    return NULL;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* "0:1,2:3", every pair is producer core : consumer core */
+static int parse(const char *topo)
+{
+    const char *s = topo;
+    int p, c, n;
+
+    npairs = 0;
+    while (*s) {
+        if (sscanf(s, "%d:%d%n", &p, &c, &n) != 2 || npairs == MAX_PAIRS)
+            return -1;
+        pairs[npairs].pcpu = p;
+        pairs[npairs].ccpu = c;
+        npairs++;
+        s += n;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -1;
+    }
+
+    return npairs ? 0 : -1;
+}
+
+/* the consumer side first; when a producer side cannot start its partner is told it is done */
+static int start_pairs(void *(*cfn)(void *), void *(*pfn)(void *))
+{
+    struct pair *p;
+    unsigned int i;
+
+    for (i = 0; i < npairs; i++) {
+        p = &pairs[i];
+        p->cstarted = spawn(&p->ctid, cfn, p) == 0;
+        p->pstarted = p->cstarted && spawn(&p->ptid, pfn, p) == 0;
+        if (!p->pstarted) {
+            __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void join_pairs(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < npairs; i++) {
+        if (pairs[i].pstarted)
+            pthread_join(pairs[i].ptid, NULL);
+        if (pairs[i].cstarted)
+            pthread_join(pairs[i].ctid, NULL);
+        pairs[i].pstarted = pairs[i].cstarted = 0;
+    }
+}
+
+/* the first n pairs, set up in full or in part */
+static void release(unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        free(pairs[i].rtt);
+        if (pairs[i].rb)
+            rb_deinit(pairs[i].rb);
+        if (pairs[i].back)
+            rb_deinit(pairs[i].back);
+        pairs[i].rtt = NULL;
+        pairs[i].rb = pairs[i].back = NULL;
+    }
+}
+
+static int run(const char *topo)
+{
+    struct timespec ts;
+    unsigned long long words = 0, ops = 0, errors = 0;
+    unsigned int *all, i;
+    double start, elapsed;
+    int failed = 0;
+
+    if (parse(topo) < 0) {
+        fprintf(stderr, "bad topology %s\n", topo);
+        return -1;
+    }
+    for (i = 0; i < npairs; i++) {
+        struct pair *p = &pairs[i];
+
+        p->rb = p->back = NULL;
+        p->rtt = NULL;
+        if (rb_init(&p->rb, rb_size) < 0 || rb_init(&p->back, rb_size) < 0) {
+            fprintf(stderr, "rb_size must be a power of 2\n");
+            release(i + 1);
+            return -1;
+        }
+        p->consumed = p->pops = p->puts = p->errors = p->final = 0;
+        p->done = p->pstarted = p->cstarted = 0;
+        p->rtt = (unsigned int *)malloc(sizeof(*p->rtt) * PINGS);
+        if (!p->rtt) {
+            fprintf(stderr, "out of memory\n");
+            release(i + 1);
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+    start = now();
+    if (start_pairs(consumer, producer) == 0) {
+        ts.tv_sec = (time_t)seconds;
+        ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    } else
+        failed = 1;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    join_pairs();
+    elapsed = now() - start;
+
+    if (!failed) {
+        __atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+        for (i = 0; i < npairs; i++)
+            rb_reinit(pairs[i].rb);
+        failed = start_pairs(ponger, pinger) < 0;
+        join_pairs();
+    }
+    if (failed) {
+        release(npairs);
+        return -1;
+    }
+
+    all = (unsigned int *)malloc(sizeof(*all) * PINGS * npairs);
+    for (i = 0; i < npairs; i++) {
+        words += pairs[i].consumed;
+        ops += pairs[i].puts + pairs[i].pops;
+        errors += pairs[i].errors;
+        if (all)
+            memcpy(all + i * PINGS, pairs[i].rtt, sizeof(*all) * PINGS);
+    }
+    release(npairs);
+    if (!all) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    qsort(all, (size_t)PINGS * npairs, sizeof(*all), cmp_uint);
+    printf("%-24s %8.2f GB/s %10.0f ops/s   one way p50 %5u ns p99 %5u ns   %s\n",
+        topo,
+        words * WORD / elapsed / 1e9,
+        ops / elapsed,
+        all[(size_t)PINGS * npairs / 2] / 2,
+        all[(size_t)PINGS * npairs * 99 / 100] / 2,
+        errors ? "CORRUPT" : "ok");
+    free(all);
+
+    return errors ? -1 : 0;
+}
+
+enum { MODE_MP, MODE_SHARD, MODE_EV };
+
+struct prod {
+    int cpu;
+    unsigned int id;
+    unsigned long long final;   /* sequence numbers sent, valid once done */
+    unsigned long long puts;
+    uint64_t *msg;
+    pthread_t tid;
+    int started;
+};
+
+struct cons {
+    int cpu;
+    unsigned int idx;
+    unsigned long long next[MAX_GROUP];     /* per producer, the lowest sequence number still to come */
+    unsigned long long cnt[MAX_GROUP];
+    unsigned long long sum[MAX_GROUP];
+    unsigned long long pops;
+    unsigned long long errors;
+    unsigned int *lat;
+    unsigned char *buf;
+    uint64_t *msg;
+    pthread_t tid;
+    int started;
+};
+
+/* a message is a header word (producer << 48 | words), the send time and the payload */
+static struct group {
+    int mode;
+    unsigned int nprod;
+    unsigned int ncons;
+    unsigned int max_words;     /* of a message, it must fit the rings */
+    unsigned int done;          /* producers that finished */
+    struct prod prod[MAX_GROUP];
+    struct cons cons[MAX_GROUP];
+    rbmp_t *mp;
+    rbshard_t *rbs;
+    rbev_t *ev;
+    int epfd;
+} grp;
+
+/* 0, or -1 when there is no room yet */
+static int group_put(struct prod *pr, unsigned int size)
+{
+    rbmp_rsv_t rsv;
+    rb_t *rb;
+
+    switch (grp.mode) {
+    case MODE_MP:
+        if (rbmp_reserve(grp.mp, size, &rsv) < 0)
+            return -1;
+        memcpy(rsv.iov[0].iov_base, pr->msg, rsv.iov[0].iov_len);
+        memcpy(rsv.iov[1].iov_base, (unsigned char *)pr->msg + rsv.iov[0].iov_len, rsv.iov[1].iov_len);
+        rbmp_commit(grp.mp, &rsv);
+        return 0;
+    case MODE_SHARD:
+        return rbshard_put(grp.rbs, pr->id % grp.ncons, (const unsigned char *)pr->msg, size) < 0 ? -1 : 0;
+    default:
+        rb = rbev_rb(grp.ev);
+        if (rb->size - (rb->in - rb_smp_out(rb)) < size)
+            return -1;
+        rbev_puts(grp.ev, (const unsigned char *)pr->msg, size);
+        return 0;
+    }
+}
+
+static void *group_producer(void *ptr)
+{
+    struct prod *pr = (struct prod *)ptr;
+    unsigned long long seq = 0;
+    unsigned int seed = 2463534242u + pr->id * 7919, spins = 0, n, i;
+
+    pin(pr->cpu);
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        n = chunk(&seed) / WORD;
+        if (n > grp.max_words - 2)
+            n = grp.max_words - 2;
+        pr->msg[0] = (uint64_t)pr->id << 48 | (n + 2);
+        for (i = 0; i < n; i++)
+            pr->msg[2 + i] = (uint64_t)pr->id << 48 | (seq + i);
+        for (;;) {
+            pr->msg[1] = now_ns();
+            if (group_put(pr, (n + 2) * WORD) == 0)
+                break;
+            if (!keep_waiting(&spins))
+                goto out;
+        }
+        seq += n;
+        pr->puts++;
+    }
+out:
+    pr->final = seq;
+    __atomic_add_fetch(&grp.done, 1, __ATOMIC_RELEASE);
+    if (grp.mode == MODE_EV)
+        rbev_flush(grp.ev);
+
+    return NULL;
+}
+
+/* with one consumer every producer's numbers come in order, with several each one sees an increasing subset */
+static void check(struct cons *c, const uint64_t *msg, unsigned int words)
+{
+    unsigned int id = (unsigned int)(msg[0] >> 48), i;
+    unsigned long long seq;
+
+    if (id >= grp.nprod || (msg[0] & 0xffffffff) != words || words < 2) {
+        c->errors++;
+        return;
+    }
+    c->lat[c->pops % SAMPLES] = (unsigned int)(now_ns() - msg[1]);
+    c->pops++;
+    for (i = 2; i < words; i++) {
+        seq = msg[i] & SEQ_MASK;
+        if (msg[i] >> 48 != id || seq < c->next[id] || (grp.ncons == 1 && seq != c->next[id]))
+            c->errors++;
+        c->next[id] = seq + 1;
+        c->cnt[id]++;
+        c->sum[id] += seq;
+    }
+}
+
+/* Whole messages from the out end of a byte stream, -1 on a broken header */
+static int take_stream(struct cons *c, rb_t *rb, unsigned int used)
+{
+    unsigned int off, words, pos, s;
+    uint64_t hdr;
+
+    for (off = 0; used - off >= WORD; off += words * WORD) {
+        pos = (rb->out + off) & rb->mask;
+        memcpy(&hdr, rb->buffer + pos, WORD);
+        words = (unsigned int)hdr;
+        if (words < 2 || words > grp.max_words) {
+            c->errors++;
+            return -1;
+        }
+        if (words * WORD > used - off)
+            break;
+        s = words * WORD;
+        if (s > rb->size - pos)
+            s = rb->size - pos;
+        memcpy(c->msg, rb->buffer + pos, s);
+        memcpy((unsigned char *)c->msg + s, rb->buffer, words * WORD - s);
+        check(c, c->msg, words);
+    }
+    rb_smp_consumed(rb, off);
+
+    return off ? 1 : 0;
+}
+
+static void *group_consumer(void *ptr)
+{
+    struct cons *c = (struct cons *)ptr;
+    struct epoll_event e;
+    const unsigned char *rec;
+    unsigned int spins = 0, len;
+    int rv;
+    rb_t *rb;
+
+    pin(c->cpu);
+    for (;;) {
+        switch (grp.mode) {
+        case MODE_MP:
+            rb = rbmp_rb(grp.mp);
+            rv = take_stream(c, rb, rbmp_sync(grp.mp));
+            break;
+        case MODE_SHARD:
+            rv = rbshard_gets(grp.rbs, c->idx, c->buf, rb_size);
+            for (rec = c->buf; rv > 0 && rec < c->buf + rv; rec = rbshard_rec_next(rec)) {
+                len = rbshard_rec_len(rec);
+                if (len % WORD || len > grp.max_words * WORD) {
+                    c->errors++;
+                    return NULL;
+                }
+                memcpy(c->msg, rbshard_rec_data(rec), len);
+                check(c, c->msg, len / WORD);
+            }
+            rv = rv < 0 ? -1 : rv > 0;
+            break;
+        default:
+            rb = rbev_rb(grp.ev);
+            rv = take_stream(c, rb, rb_smp_in(rb) - rb->out);
+            if (rv == 0 && rbev_arm(grp.ev))
+                rv = 1;
+            break;
+        }
+        if (rv < 0)
+            return NULL;
+        if (rv)
+            continue;
+        /* every producer has finished, what it sent is visible now */
+        if (__atomic_load_n(&grp.done, __ATOMIC_ACQUIRE) == grp.nprod) {
+            if (grp.mode == MODE_MP && rbmp_sync(grp.mp))
+                continue;
+            if (grp.mode == MODE_SHARD && rbshard_used_size(grp.rbs))
+                continue;
+            if (grp.mode == MODE_EV && rb_smp_in(rbev_rb(grp.ev)) != rbev_rb(grp.ev)->out)
+                continue;
+            return NULL;
+        }
+        if (grp.mode == MODE_EV)
+            epoll_wait(grp.epfd, &e, 1, 100);
+        else
+            backoff(&spins);
+    }
+}
+
+/* "+" separated cores */
+static int parse_cpus(const char **s, int *cpu, unsigned int *n)
+{
+    int c, len;
+
+    *n = 0;
+    do {
+        if (sscanf(*s, "%d%n", &c, &len) != 1 || *n == MAX_GROUP)
+            return -1;
+        cpu[(*n)++] = c;
+        *s += len;
+    } while (**s == '+' && (*s)++);
+
+    return 0;
+}
+
+/* "mp:0+1+2:3", "shard:0+1:2+3", "ev:0:1" */
+static int parse_group(const char *topo)
+{
+    int pcpu[MAX_GROUP], ccpu[MAX_GROUP];
+    const char *s;
+    unsigned int i;
+
+    if (!strncmp(topo, "mp:", 3))
+        grp.mode = MODE_MP;
+    else if (!strncmp(topo, "shard:", 6))
+        grp.mode = MODE_SHARD;
+    else if (!strncmp(topo, "ev:", 3))
+        grp.mode = MODE_EV;
+    else
+        return -1;
+    s = strchr(topo, ':') + 1;
+    if (parse_cpus(&s, pcpu, &grp.nprod) < 0 || *s++ != ':' || parse_cpus(&s, ccpu, &grp.ncons) < 0 || *s)
+        return -1;
+    if (grp.mode != MODE_SHARD && grp.ncons != 1)
+        return -1;
+    if (grp.mode == MODE_EV && grp.nprod != 1)
+        return -1;
+    for (i = 0; i < grp.nprod; i++) {
+        grp.prod[i].cpu = pcpu[i];
+        grp.prod[i].id = i;
+    }
+    for (i = 0; i < grp.ncons; i++) {
+        grp.cons[i].cpu = ccpu[i];
+        grp.cons[i].idx = i;
+    }
+
+    return 0;
+}
+
+static void group_release(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < grp.nprod; i++) {
+        free(grp.prod[i].msg);
+        grp.prod[i].msg = NULL;
+    }
+    for (i = 0; i < grp.ncons; i++) {
+        free(grp.cons[i].lat);
+        free(grp.cons[i].buf);
+        free(grp.cons[i].msg);
+        grp.cons[i].lat = NULL;
+        grp.cons[i].buf = NULL;
+        grp.cons[i].msg = NULL;
+    }
+    if (grp.mp)
+        rbmp_deinit(grp.mp);
+    if (grp.rbs)
+        rbshard_deinit(grp.rbs);
+    if (grp.epfd >= 0)
+        close(grp.epfd);
+    if (grp.ev)
+        rbev_deinit(grp.ev);
+    grp.mp = NULL;
+    grp.rbs = NULL;
+    grp.ev = NULL;
+    grp.epfd = -1;
+}
+
+static int group_setup(void)
+{
+    struct epoll_event e;
+    size_t msg_size;
+    unsigned int i;
+    int rv;
+
+    grp.mp = NULL;
+    grp.rbs = NULL;
+    grp.ev = NULL;
+    grp.epfd = -1;
+    grp.done = 0;
+    /* room for a shard record header, the payload stays whole words */
+    grp.max_words = (max_chunk + 2 * WORD < rb_size - WORD ? max_chunk + 2 * WORD : rb_size - WORD) / WORD;
+    if (grp.max_words < 3) {
+        fprintf(stderr, "rb_size too small for a group\n");
+        return -1;
+    }
+    msg_size = grp.max_words * WORD;
+    for (i = 0; i < grp.nprod; i++) {
+        grp.prod[i].final = grp.prod[i].puts = 0;
+        grp.prod[i].started = 0;
+        grp.prod[i].msg = (uint64_t *)malloc(msg_size);
+        if (!grp.prod[i].msg)
+            return -ENOMEM;
+    }
+    for (i = 0; i < grp.ncons; i++) {
+        struct cons *c = &grp.cons[i];
+
+        memset(c->next, 0, sizeof(c->next));
+        memset(c->cnt, 0, sizeof(c->cnt));
+        memset(c->sum, 0, sizeof(c->sum));
+        c->pops = c->errors = 0;
+        c->started = 0;
+        c->lat = (unsigned int *)malloc(sizeof(*c->lat) * SAMPLES);
+        c->buf = (unsigned char *)malloc(rb_size);
+        c->msg = (uint64_t *)malloc(msg_size);
+        if (!c->lat || !c->buf || !c->msg)
+            return -ENOMEM;
+    }
+    switch (grp.mode) {
+    case MODE_MP:
+        return rbmp_init(&grp.mp, rb_size, 256);
+    case MODE_SHARD:
+        return rbshard_init(&grp.rbs, grp.ncons, rb_size);
+    default:
+        rv = rbev_init(&grp.ev, rb_size, 0);
+        if (rv < 0)
+            return rv;
+        grp.epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (grp.epfd < 0)
+            return -errno;
+        e.events = EPOLLIN;
+        e.data.ptr = grp.ev;
+        if (epoll_ctl(grp.epfd, EPOLL_CTL_ADD, rbev_fd(grp.ev), &e) < 0)
+            return -errno;
+        return 0;
+    }
+}
+
+static int run_group(const char *topo)
+{
+    struct timespec ts;
+    unsigned long long words = 0, ops = 0, errors = 0, cnt, sum, n;
+    unsigned int *all, i, j, samples = 0;
+    double start, elapsed;
+    int rv, failed = 0;
+
+    if (parse_group(topo) < 0) {
+        fprintf(stderr, "bad topology %s\n", topo);
+        return -1;
+    }
+    rv = group_setup();
+    if (rv < 0) {
+        fprintf(stderr, "cannot set up %s: %s\n", topo, strerror(-rv));
+        group_release();
+        return -1;
+    }
+
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+    start = now();
+    for (i = 0; i < grp.ncons && !failed; i++)
+        failed = !(grp.cons[i].started = spawn(&grp.cons[i].tid, group_consumer, &grp.cons[i]) == 0);
+    for (i = 0; i < grp.nprod && !failed; i++)
+        failed = !(grp.prod[i].started = spawn(&grp.prod[i].tid, group_producer, &grp.prod[i]) == 0);
+    /* producers that never ran count as done, or the consumers would wait for them */
+    for (i = 0; i < grp.nprod; i++)
+        if (!grp.prod[i].started)
+            __atomic_add_fetch(&grp.done, 1, __ATOMIC_RELEASE);
+    if (!failed) {
+        ts.tv_sec = (time_t)seconds;
+        ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < grp.nprod; i++)
+        if (grp.prod[i].started)
+            pthread_join(grp.prod[i].tid, NULL);
+    for (i = 0; i < grp.ncons; i++)
+        if (grp.cons[i].started)
+            pthread_join(grp.cons[i].tid, NULL);
+    elapsed = now() - start;
+    if (failed) {
+        group_release();
+        return -1;
+    }
+
+    /* every producer's numbers arrived once each, whichever consumer took them */
+    for (i = 0; i < grp.nprod; i++) {
+        for (cnt = sum = 0, j = 0; j < grp.ncons; j++) {
+            cnt += grp.cons[j].cnt[i];
+            sum += grp.cons[j].sum[i];
+        }
+        n = grp.prod[i].final;
+        if (cnt != n || sum != (n ? n * (n - 1) / 2 : 0))
+            errors++;
+        words += cnt;
+        ops += grp.prod[i].puts;
+    }
+    for (j = 0; j < grp.ncons; j++) {
+        errors += grp.cons[j].errors;
+        ops += grp.cons[j].pops;
+        samples += grp.cons[j].pops < SAMPLES ? (unsigned int)grp.cons[j].pops : SAMPLES;
+    }
+    all = (unsigned int *)malloc(sizeof(*all) * (samples ? samples : 1));
+    if (!all) {
+        fprintf(stderr, "out of memory\n");
+        group_release();
+        return -1;
+    }
+    for (samples = 0, j = 0; j < grp.ncons; j++) {
+        n = grp.cons[j].pops < SAMPLES ? grp.cons[j].pops : SAMPLES;
+        memcpy(all + samples, grp.cons[j].lat, sizeof(*all) * n);
+        samples += (unsigned int)n;
+    }
+    group_release();
+    qsort(all, samples, sizeof(*all), cmp_uint);
+    printf("%-24s %8.2f GB/s %10.0f ops/s   one way p50 %5u ns p99 %5u ns   %s\n",
+        topo,
+        words * WORD / elapsed / 1e9,
+        ops / elapsed,
+        samples ? all[samples / 2] : 0,
+        samples ? all[(size_t)samples * 99 / 100] : 0,
+        errors ? "CORRUPT" : "ok");
+    free(all);
+
+    return errors ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    char all[MAX_PAIRS * 12], def[32];
+    int ncpu, i, rv = 0;
+    size_t n;
+
+    if (argc > 1)
+        seconds = atof(argv[1]);
+    if (argc > 2)
+        rb_size = atoi(argv[2]) << 10;
+    if (argc > 3)
+        max_chunk = atoi(argv[3]);
+    if (max_chunk < WORD || max_chunk > rb_size) {
+        fprintf(stderr, "max_chunk must be %u..rb_size\n", (unsigned int)WORD);
+        return 1;
+    }
+
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%d cpus, rb %u KB, chunk %u..%u\n", ncpu, rb_size >> 10, (unsigned int)WORD, max_chunk);
+    if (argc > 4) {
+        for (i = 4; i < argc; i++)
+            rv |= isdigit((unsigned char)argv[i][0]) ? run(argv[i]) : run_group(argv[i]);
+        return rv ? 1 : 0;
+    }
+
+    /* neighbours, farthest apart, every core busy */
+    if (ncpu == 1)
+        rv |= run("0:0");
+    if (ncpu > 1)
+        rv |= run("0:1");
+    if (ncpu > 2) {
+        snprintf(def, sizeof(def), "0:%d", ncpu - 1);
+        rv |= run(def);
+    }
+    if (ncpu > 3) {
+        all[0] = '\0';
+        for (i = 0, n = 0; i + 1 < ncpu && i / 2 < MAX_PAIRS; i += 2)
+            n += snprintf(all + n, sizeof(all) - n, "%s%d:%d", n ? "," : "", i, i + 1);
+        rv |= run(all);
+    }
+
+    /* many producers into one consumer, a producer and a consumer per shard, eventfd wakeups */
+    if (ncpu == 1) {
+        rv |= run_group("mp:0+0+0:0");
+        rv |= run_group("shard:0+0:0+0");
+        rv |= run_group("ev:0:0");
+        return rv ? 1 : 0;
+    }
+    all[0] = '\0';
+    for (i = 0, n = 0; i + 1 < ncpu && i < MAX_GROUP; i++)
+        n += snprintf(all + n, sizeof(all) - n, "%s%d", n ? "+" : "mp:", i);
+    snprintf(all + n, sizeof(all) - n, ":%d", ncpu - 1);
+    rv |= run_group(all);
+    if (ncpu > 3) {
+        all[0] = '\0';
+        for (i = 0, n = 0; i < ncpu / 2 && i < MAX_GROUP; i++)
+            n += snprintf(all + n, sizeof(all) - n, "%s%d", n ? "+" : "shard:", i);
+        for (i = 0; i < ncpu / 2 && i < MAX_GROUP; i++)
+            n += snprintf(all + n, sizeof(all) - n, "%c%d", i ? '+' : ':', ncpu / 2 + i);
+        rv |= run_group(all);
+    }
+    rv |= run_group("ev:0:1");
+
+    return rv ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* copy engine for rb_puts/rb_gets and friends, large copies bypass the cache */
+
+#include "ringbuffer.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_NT_COPY
+#endif
+
+#define PREFETCH_DISTANCE   512
+
+/* set from any thread while others copy */
+static size_t copy_threshold = RB_COPY_THRESHOLD;
+
+void rb_set_copy_threshold(size_t threshold)
+{
+    __atomic_store_n(&copy_threshold, threshold, __ATOMIC_RELAXED);
+}
+
+size_t rb_copy_threshold(void)
+{
+    return __atomic_load_n(&copy_threshold, __ATOMIC_RELAXED);
+}
+
+#ifdef HAVE_NT_COPY
+
+static void *nt_copy_resolve(void *dst, const void *src, size_t n);
+static void *(*nt_copy)(void *, const void *, size_t) = nt_copy_resolve;
+
+/* Align the destination, stream whole lines, leave the tail to memcpy */
+static void *nt_copy_sse2(void *dst, const void *src, size_t n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    size_t head;
+
+    head = (size_t)(-(uintptr_t)d & 15);
+    if (n < head + 64)
+        return memcpy(dst, src, n);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a, b, c, e;
+
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        a = _mm_loadu_si128((const __m128i *)s);
+        b = _mm_loadu_si128((const __m128i *)(s + 16));
+        c = _mm_loadu_si128((const __m128i *)(s + 32));
+        e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *nt_copy_avx2(void *dst, const void *src, size_t n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    size_t head;
+
+    head = (size_t)(-(uintptr_t)d & 31);
+    if (n < head + 128)
+        return memcpy(dst, src, n);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        __m256i a, b, c, e;
+
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+        a = _mm256_loadu_si256((const __m256i *)s);
+        b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+    memcpy(d, s, n);
+
+    return dst;
+}
+
+__attribute__((target("avx512f")))
+static void *nt_copy_avx512(void *dst, const void *src, size_t n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    size_t head;
+
+    head = (size_t)(-(uintptr_t)d & 63);
+    if (n < head + 256)
+        return memcpy(dst, src, n);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 256; n -= 256, d += 256, s += 256) {
+        __m512i a, b, c, e;
+
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE + 128, _MM_HINT_NTA);
+        _mm_prefetch((const char *)s + PREFETCH_DISTANCE + 192, _MM_HINT_NTA);
+        a = _mm512_loadu_si512((const void *)s);
+        b = _mm512_loadu_si512((const void *)(s + 64));
+        c = _mm512_loadu_si512((const void *)(s + 128));
+        e = _mm512_loadu_si512((const void *)(s + 192));
+        _mm512_stream_si512((__m512i *)d, a);
+        _mm512_stream_si512((__m512i *)(d + 64), b);
+        _mm512_stream_si512((__m512i *)(d + 128), c);
+        _mm512_stream_si512((__m512i *)(d + 192), e);
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+    memcpy(d, s, n);
+
+    return dst;
+}
+
+/* Picked once on the first large copy, racing threads store the same pointer */
+static void *nt_copy_resolve(void *dst, const void *src, size_t n)
+{
+    void *(*fn)(void *, const void *, size_t);
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        fn = nt_copy_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+        fn = nt_copy_avx2;
+    else
+        fn = nt_copy_sse2;
+    __atomic_store_n(&nt_copy, fn, __ATOMIC_RELAXED);
+
+    return fn(dst, src, n);
+}
+
+const char *rb_copy_engine(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512";
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    return "sse2";
+}
+
+void *rb_memcpy(void *dst, const void *src, size_t n)
+{
+    size_t threshold = __atomic_load_n(&copy_threshold, __ATOMIC_RELAXED);
+
+    if (threshold && n >= threshold)
+        return __atomic_load_n(&nt_copy, __ATOMIC_RELAXED)(dst, src, n);
+
+    return memcpy(dst, src, n);
+}
+
+#else
+
+const char *rb_copy_engine(void)
+{
+    return "memcpy";
+}
+
+void *rb_memcpy(void *dst, const void *src, size_t n)
+{
+    return memcpy(dst, src, n);
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/*
+ * eventfd wakeups for a single producer single consumer rb_t
+ *
+ * The consumer sets armed before it sleeps and checks the ring again, the
+ * producer publishes in and then takes armed. Both sides use sequentially
+ * consistent operations between their store and their load, so either the
+ * consumer sees the new data or the producer sees armed, a wakeup is never lost.
+ */
+
+#include "rbev.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#ifndef min
+#define min(a,b)    (((a) < (b)) ? (a) : (b))
+#endif
+
+static int signal_consumer(rbev_t *ev);
+
+/* batch 0 or 1 signals on every empty to non-empty transition */
+int rbev_init(rbev_t **ev, unsigned int size, unsigned int batch)
+{
+    rbev_t *_ev;
+    int rv;
+
+    if (batch > size)
+        return -EINVAL;
+    _ev = (rbev_t *)malloc(sizeof(*_ev));
+    if (!_ev)
+        return -ENOMEM;
+    rv = rb_init(&_ev->rb, size);
+    if (rv < 0) {
+        free(_ev);
+        return rv;
+    }
+    _ev->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_ev->fd < 0) {
+        rv = -errno;
+        rb_deinit(_ev->rb);
+        free(_ev);
+        return rv;
+    }
+    _ev->batch = batch ? batch : 1;
+    _ev->armed = 1;
+    _ev->taken = 0;
+    _ev->signals = 0;
+    *ev = _ev;
+
+    return 0;
+}
+
+void rbev_deinit(rbev_t *ev)
+{
+    close(ev->fd);
+    rb_deinit(ev->rb);
+    free(ev);
+}
+
+unsigned int rbev_puts(rbev_t *ev, const unsigned char *buf, unsigned int size)
+{
+    rb_t *rb = ev->rb;
+    unsigned int avail_size, roll_size, s;
+
+    avail_size = rb->size - (rb->in - rb_smp_out(rb));
+    size = min(size, avail_size);
+    if (!size)
+        return 0;
+    roll_size = rb->size - (rb->in & rb->mask);
+    s = min(size, roll_size);
+    rb_memcpy(rb->buffer + (rb->in & rb->mask), buf, s);
+    rb_memcpy(rb->buffer, buf + s, size - s);
+    rbev_produced(ev, size);
+
+    return size;
+}
+
+/* After filling rb_producer_peek(rbev_rb(ev), ...) */
+void rbev_produced(rbev_t *ev, unsigned int size)
+{
+    rb_t *rb = ev->rb;
+
+    __atomic_store_n(&rb->in, rb->in + size, __ATOMIC_SEQ_CST);
+    if (rb->in - __atomic_load_n(&rb->out, __ATOMIC_SEQ_CST) < ev->batch)
+        return;
+    if (__atomic_load_n(&ev->armed, __ATOMIC_SEQ_CST))
+        signal_consumer(ev);
+}
+
+/* Wake a waiting consumer for whatever is stored, even below the batch */
+int rbev_flush(rbev_t *ev)
+{
+    rb_t *rb = ev->rb;
+
+    if (rb->in == __atomic_load_n(&rb->out, __ATOMIC_SEQ_CST))
+        return 0;
+    if (!__atomic_load_n(&ev->armed, __ATOMIC_SEQ_CST))
+        return 0;
+
+    return signal_consumer(ev);
+}
+
+unsigned int rbev_gets(rbev_t *ev, unsigned char *buf, unsigned int size)
+{
+    rb_t *rb = ev->rb;
+    unsigned int used_size, roll_size, s;
+
+    used_size = rb_smp_in(rb) - rb->out;
+    size = min(size, used_size);
+    if (!size)
+        return 0;
+    roll_size = rb->size - (rb->out & rb->mask);
+    s = min(size, roll_size);
+    rb_memcpy(buf, rb->buffer + (rb->out & rb->mask), s);
+    rb_memcpy(buf + s, rb->buffer, size - s);
+    rb_smp_consumed(rb, size);
+
+    return size;
+}
+
+/*
+ * Call when the ring is drained, before going back to epoll_wait.
+ * 0: armed, sleep on rbev_fd. 1: a batch arrived meanwhile, keep consuming.
+ */
+int rbev_arm(rbev_t *ev)
+{
+    rb_t *rb = ev->rb;
+    uint64_t cnt;
+    ssize_t n;
+
+    /* the producer took armed and has written, or is about to, the eventfd */
+    if (!ev->taken && !__atomic_load_n(&ev->armed, __ATOMIC_SEQ_CST)) {
+        while ((n = read(ev->fd, &cnt, sizeof(cnt))) < 0 && errno == EINTR)
+            ;
+        /* not written yet: stay disarmed, the write wakes epoll and the next call reads it */
+        if (n < 0)
+            return 0;
+    }
+    ev->taken = 0;
+    __atomic_store_n(&ev->armed, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rb->in, __ATOMIC_SEQ_CST) - rb->out < ev->batch)
+        return 0;
+    if (__atomic_exchange_n(&ev->armed, 0, __ATOMIC_SEQ_CST))
+        ev->taken = 1;
+
+    return 1;
+}
+
+static int signal_consumer(rbev_t *ev)
+{
+    uint64_t one = 1;
+
+    if (!__atomic_exchange_n(&ev->armed, 0, __ATOMIC_SEQ_CST))
+        return 0;
+    ev->signals++;
+    while (write(ev->fd, &one, sizeof(one)) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+
+    return 1;
+}
@@ -0,0 +1,49 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBEV_H__
+#define __RBEV_H__
+
+#include "ringbuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A rb_t shared by one producer thread and one consumer thread, with an
+ * eventfd the consumer puts in its epoll set. The producer writes the
+ * eventfd only when the consumer is waiting and at least batch bytes are
+ * stored, so a burst costs one write and one read instead of one per message.
+ */
+typedef struct rbev_t{
+    rb_t *rb;
+    int fd;
+    unsigned int batch;
+    int armed;                  /* the consumer waits on fd, taken by whoever clears it */
+    int taken;                  /* consumer only, rbev_arm cleared armed itself */
+    unsigned long long signals; /* producer only */
+} rbev_t;
+
+int rbev_init(rbev_t **ev, unsigned int size, unsigned int batch);
+void rbev_deinit(rbev_t *ev);
+/* producer */
+unsigned int rbev_puts(rbev_t *ev, const unsigned char *buf, unsigned int size);
+void rbev_produced(rbev_t *ev, unsigned int size);
+int rbev_flush(rbev_t *ev);
+/* consumer */
+unsigned int rbev_gets(rbev_t *ev, unsigned char *buf, unsigned int size);
+int rbev_arm(rbev_t *ev);
+#define rbev_consumed(ev, size) rb_smp_consumed((ev)->rb, size)
+#define rbev_fd(ev)             ((ev)->fd)
+#define rbev_rb(ev)             ((ev)->rb)
+#define rbev_batch(ev)          ((ev)->batch)
+#define rbev_signals(ev)        ((ev)->signals)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RBEV_H__ */
@@ -0,0 +1,110 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* hand buffers to the next process on a hot restart, fds go as SCM_RIGHTS */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "rbhandoff.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+int rbhandoff_send(int sock, const int *fds, unsigned int fd_cnt, const void *buf, unsigned int size)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * RBHANDOFF_MAX_FDS)];
+    } ctl;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned char dummy = 0;
+    ssize_t n;
+
+    if (fd_cnt > RBHANDOFF_MAX_FDS)
+        return -EINVAL;
+    /* a message must carry at least one byte */
+    iov.iov_base = size ? (void *)buf : &dummy;
+    iov.iov_len = size ? size : 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd_cnt) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_cnt);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_cnt);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_cnt);
+    }
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -errno;
+    if ((size_t)n != iov.iov_len)
+        return -EMSGSIZE;
+
+    return 0;
+}
+
+int rbhandoff_recv(int sock, int *fds, unsigned int *fd_cnt, void *buf, unsigned int *size)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * RBHANDOFF_MAX_FDS)];
+    } ctl;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned char dummy;
+    unsigned int cnt = 0, i;
+    ssize_t n;
+
+    iov.iov_base = *size ? buf : &dummy;
+    iov.iov_len = *size ? *size : 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -errno;
+    if (n == 0)
+        return -ECONNRESET;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        int *p;
+        unsigned int c;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        p = (int *)CMSG_DATA(cmsg);
+        c = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < c; i++, cnt++) {
+            if (cnt < *fd_cnt)
+                fds[cnt] = p[i];
+            else
+                close(p[i]);
+        }
+    }
+    /* nothing half delivered, the caller does not own fds it was not told about */
+    if (cnt > *fd_cnt || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (i = 0; i < cnt && i < *fd_cnt; i++)
+            close(fds[i]);
+        return -EMSGSIZE;
+    }
+    *fd_cnt = cnt;
+    *size = *size ? (unsigned int)n : 0;
+
+    return 0;
+}
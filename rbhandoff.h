@@ -0,0 +1,31 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBHANDOFF_H__
+#define __RBHANDOFF_H__
+
+#include "ringbuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* SCM_MAX_FD of linux */
+#define RBHANDOFF_MAX_FDS   253
+
+/*
+ * Pass the memfds of detached buffers (rb_detach/rbvec_detach) and the
+ * sockets they belong to over a unix socket, buf is an application
+ * message describing them. The sender closes its fds after sending.
+ */
+int rbhandoff_send(int sock, const int *fds, unsigned int fd_cnt, const void *buf, unsigned int size);
+/* fd_cnt and size are capacities on input, what arrived on return */
+int rbhandoff_recv(int sock, int *fds, unsigned int *fd_cnt, void *buf, unsigned int *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RBHANDOFF_H__ */
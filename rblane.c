@@ -0,0 +1,276 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/*
+ * priority lanes over one write path
+ *
+ * Every rblane_write round plans one writev: the rest of a half written
+ * message, then the strict lanes, then deficit round robin over the weighted
+ * lanes, until RBLANE_IOV_MAX or batch bytes. The plan runs on scratch
+ * copies; only what write_cb actually took is consumed and charged, a
+ * message is charged in full when its first byte goes out.
+ */
+
+#include "rblane.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef min
+#define min(a,b)    (((a) < (b)) ? (a) : (b))
+#endif
+
+#define LEN_SIZE    sizeof(unsigned int)
+#define LENS_MIN    16
+
+typedef struct plan_ent_t{
+    unsigned int lane;
+    unsigned int len;
+    int charged;
+    unsigned int deficit;       /* the lane's deficit once this message is started */
+} plan_ent_t;
+
+typedef struct plan_t{
+    struct iovec iov[RBLANE_IOV_MAX];
+    unsigned int iov_cnt;
+    plan_ent_t ent[RBLANE_IOV_MAX];
+    unsigned int ent_cnt;
+    unsigned int bytes;
+} plan_t;
+
+static unsigned int lane_msgs(rblane_lane_t *l);
+static unsigned int lane_len(rblane_lane_t *l, unsigned int k);
+static plan_ent_t *plan_add(rblane_t *rbl, plan_t *p, unsigned int i, unsigned int len);
+static void plan(rblane_t *rbl, plan_t *p);
+static void commit(rblane_t *rbl, plan_t *p, unsigned int n);
+
+/* size is per lane and a power of 2, each lane queues up to size / 16 messages */
+int rblane_init(rblane_t **rbl, unsigned int num, unsigned int size)
+{
+    rblane_t *_rbl;
+    unsigned int i;
+    int rv;
+
+    if (!num)
+        return -EINVAL;
+    _rbl = (rblane_t *)calloc(1, sizeof(*_rbl) + sizeof(rblane_lane_t) * num);
+    if (!_rbl)
+        return -ENOMEM;
+    _rbl->num = num;
+    _rbl->batch = RBLANE_BATCH;
+    _rbl->cur = -1;
+    for (i = 0; i < num; i++) {
+        rv = rb_init(&_rbl->lane[i].data, size);
+        if (rv == 0) {
+            rv = rb_init(&_rbl->lane[i].lens, size / 4 < LENS_MIN ? LENS_MIN : size / 4);
+            if (rv < 0)
+                rb_deinit(_rbl->lane[i].data);
+        }
+        if (rv < 0) {
+            while (i--) {
+                rb_deinit(_rbl->lane[i].data);
+                rb_deinit(_rbl->lane[i].lens);
+            }
+            free(_rbl);
+            return rv;
+        }
+    }
+    *rbl = _rbl;
+
+    return 0;
+}
+
+void rblane_deinit(rblane_t *rbl)
+{
+    unsigned int i;
+
+    for (i = 0; i < rbl->num; i++) {
+        rb_deinit(rbl->lane[i].data);
+        rb_deinit(rbl->lane[i].lens);
+    }
+    free(rbl);
+}
+
+int rblane_set_quantum(rblane_t *rbl, unsigned int lane, unsigned int quantum)
+{
+    if (lane >= rbl->num)
+        return -EINVAL;
+    rbl->lane[lane].quantum = quantum;
+    rbl->lane[lane].deficit = 0;
+
+    return 0;
+}
+
+/* the whole message or nothing, -EAGAIN when the lane is full */
+int rblane_puts(rblane_t *rbl, unsigned int lane, const unsigned char *buf, unsigned int size)
+{
+    rblane_lane_t *l;
+
+    if (lane >= rbl->num || !size)
+        return -EINVAL;
+    l = &rbl->lane[lane];
+    if (size > rb_size(l->data))
+        return -EINVAL;
+    if (rb_avail_size(l->data) < size || rb_avail_size(l->lens) < LEN_SIZE)
+        return -EAGAIN;
+    rb_puts(l->data, buf, size);
+    rb_puts(l->lens, (const unsigned char *)&size, LEN_SIZE);
+
+    return 0;
+}
+
+int rblane_write(rblane_t *rbl, rb_write_pt write_cb, void *ptr, unsigned int *wrote)
+{
+    plan_t p;
+    int rv;
+
+    do {
+        rv = 0;
+        plan(rbl, &p);
+        if (p.bytes) {
+            rv = write_cb(ptr, p.iov, p.iov_cnt);
+            if (rv > 0) {
+                commit(rbl, &p, (unsigned int)rv);
+                *wrote += (unsigned int)rv;
+            }
+        }
+    } while (rv > 0 && (unsigned int)rv == p.bytes);
+
+    return rv;
+}
+
+unsigned int rblane_used_size(rblane_t *rbl)
+{
+    unsigned int i, used = 0;
+
+    for (i = 0; i < rbl->num; i++)
+        used += rb_used_size(rbl->lane[i].data);
+
+    return used;
+}
+
+static unsigned int lane_msgs(rblane_lane_t *l)
+{
+    return rb_used_size(l->lens) / LEN_SIZE;
+}
+
+static unsigned int lane_len(rblane_lane_t *l, unsigned int k)
+{
+    unsigned int len = 0;
+
+    rb_peek(l->lens, k * LEN_SIZE, &len, LEN_SIZE);
+
+    return len;
+}
+
+/* NULL when the writev is full, the first message always fits */
+static plan_ent_t *plan_add(rblane_t *rbl, plan_t *p, unsigned int i, unsigned int len)
+{
+    rblane_lane_t *l = &rbl->lane[i];
+    plan_ent_t *e;
+    unsigned char *buf;
+    unsigned int n;
+
+    if (p->iov_cnt + 2 > RBLANE_IOV_MAX)
+        return NULL;
+    if (p->ent_cnt && p->bytes + len > rbl->batch)
+        return NULL;
+    e = &p->ent[p->ent_cnt++];
+    e->lane = i;
+    e->len = len;
+    e->charged = 0;
+    p->bytes += len;
+    while (len) {
+        n = rb_consumer_peek_at(l->data, l->p_off, len, &buf);
+        p->iov[p->iov_cnt].iov_base = buf;
+        p->iov[p->iov_cnt].iov_len = n;
+        p->iov_cnt++;
+        l->p_off += n;
+        len -= n;
+    }
+    l->p_msg++;
+
+    return e;
+}
+
+static void plan(rblane_t *rbl, plan_t *p)
+{
+    rblane_lane_t *l;
+    plan_ent_t *e;
+    unsigned int i, next, idle, len, paid;
+
+    p->iov_cnt = p->ent_cnt = p->bytes = 0;
+    for (i = 0; i < rbl->num; i++) {
+        rbl->lane[i].p_off = rbl->lane[i].p_msg = 0;
+        rbl->lane[i].p_deficit = rbl->lane[i].deficit;
+    }
+    /* the stream is in the middle of a message, nothing may cut in */
+    if (rbl->cur >= 0) {
+        l = &rbl->lane[rbl->cur];
+        plan_add(rbl, p, (unsigned int)rbl->cur, lane_len(l, 0) - l->sent);
+    }
+    for (i = 0; i < rbl->num; i++) {
+        l = &rbl->lane[i];
+        if (l->quantum)
+            continue;
+        while (l->p_msg < lane_msgs(l))
+            if (!plan_add(rbl, p, i, lane_len(l, l->p_msg)))
+                return;
+    }
+    /* stops after a whole pass over lanes with nothing left to plan */
+    i = rbl->rr % rbl->num;
+    paid = rbl->paid;
+    for (idle = 0; idle < rbl->num; i = next, paid = 0) {
+        l = &rbl->lane[i];
+        next = (i + 1) % rbl->num;
+        if (!l->quantum || l->p_msg == lane_msgs(l)) {
+            idle++;
+            continue;
+        }
+        idle = 0;
+        if (!paid)
+            l->p_deficit += l->quantum;
+        while (l->p_msg < lane_msgs(l) && (len = lane_len(l, l->p_msg)) <= l->p_deficit) {
+            e = plan_add(rbl, p, i, len);
+            if (!e)
+                return;
+            l->p_deficit -= len;
+            e->charged = 1;
+            e->deficit = l->p_deficit;
+        }
+    }
+}
+
+static void commit(rblane_t *rbl, plan_t *p, unsigned int n)
+{
+    rblane_lane_t *l;
+    plan_ent_t *e;
+    unsigned int i, w;
+
+    for (i = 0; i < p->ent_cnt && n; i++) {
+        e = &p->ent[i];
+        l = &rbl->lane[e->lane];
+        w = min(n, e->len);
+        if (e->charged) {
+            l->deficit = e->deficit;
+            rbl->rr = e->lane;
+            rbl->paid = 1;
+        }
+        rb_consumed(l->data, w);
+        l->sent += w;
+        n -= w;
+        if (l->sent < lane_len(l, 0)) {
+            rbl->cur = (int)e->lane;
+            break;
+        }
+        rb_consumed(l->lens, LEN_SIZE);
+        l->sent = 0;
+        rbl->cur = -1;
+    }
+    /* an emptied lane does not bank its deficit */
+    for (i = 0; i < rbl->num; i++)
+        if (rb_is_empty(rbl->lane[i].lens))
+            rbl->lane[i].deficit = 0;
+}
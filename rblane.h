@@ -0,0 +1,60 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBLANE_H__
+#define __RBLANE_H__
+
+#include "ringbuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RBLANE_IOV_MAX  64
+#define RBLANE_BATCH    65536
+
+typedef struct rblane_lane_t{
+    rb_t *data;
+    rb_t *lens;                 /* one unsigned int per queued message */
+    unsigned int quantum;       /* 0: strict priority, otherwise bytes per deficit round robin round */
+    unsigned int deficit;
+    unsigned int sent;          /* bytes of the head message already written */
+    /* planning scratch of rblane_write */
+    unsigned int p_off;
+    unsigned int p_msg;
+    unsigned int p_deficit;
+} rblane_lane_t;
+
+/*
+ * Several message lanes sharing one byte stream. Strict lanes go first in
+ * index order, the weighted ones share what is left by deficit round robin.
+ * Messages are never interleaved: a half written message is finished before
+ * anything else is offered.
+ */
+typedef struct rblane_t{
+    unsigned int num;
+    unsigned int batch;         /* bytes offered per write_cb call, at least one message */
+    int cur;                    /* lane with a half written message, -1 if none */
+    unsigned int rr;            /* weighted lane the round robin resumes at */
+    unsigned int paid;          /* rr already got its quantum for this visit */
+    rblane_lane_t lane[0];
+} rblane_t;
+
+int rblane_init(rblane_t **rbl, unsigned int num, unsigned int size);
+void rblane_deinit(rblane_t *rbl);
+int rblane_set_quantum(rblane_t *rbl, unsigned int lane, unsigned int quantum);
+int rblane_puts(rblane_t *rbl, unsigned int lane, const unsigned char *buf, unsigned int size);
+/* write_cb gets (ptr, struct iovec *, cnt) like rbvec_write */
+int rblane_write(rblane_t *rbl, rb_write_pt write_cb, void *ptr, unsigned int *wrote);
+unsigned int rblane_used_size(rblane_t *rbl);
+#define rblane_num(rbl)                 ((rbl)->num)
+#define rblane_lane_used(rbl, lane)     rb_used_size((rbl)->lane[lane].data)
+#define rblane_set_batch(rbl, b)        ((rbl)->batch = (b))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RBLANE_H__ */
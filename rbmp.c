@@ -0,0 +1,168 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/*
+ * multi producer reserve/commit over a rb_t
+ *
+ * rsv hands out (seq, pos) pairs with one CAS, so a reservation is a byte
+ * range plus a slot. Committing stores seq + 1 into the slot, then every
+ * committer tries to move pub over the slots that are committed in order.
+ * The slot store and the loads of the publishing loop are sequentially
+ * consistent: of two adjacent committers at least one sees the other's
+ * slot, so the prefix never stalls behind a commit nobody publishes.
+ */
+
+#include "rbmp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef min
+#define min(a,b)    (((a) < (b)) ? (a) : (b))
+#endif
+
+#define SEQ(v)      ((unsigned int)((v) >> 32))
+#define POS(v)      ((unsigned int)(v))
+#define PACK(s, p)  (((unsigned long long)(s) << 32) | (p))
+
+static int is_power_of_2(unsigned long n);
+static void publish(rbmp_t *mp);
+
+/* slots bounds the reservations that are not published yet */
+int rbmp_init(rbmp_t **mp, unsigned int size, unsigned int slots)
+{
+    rbmp_t *_mp;
+    unsigned int i;
+    int rv;
+
+    if (!is_power_of_2(slots))
+        return -EINVAL;
+    _mp = (rbmp_t *)aligned_alloc(64, (sizeof(*_mp) + sizeof(rbmp_slot_t) * slots + 63) & ~63UL);
+    if (!_mp)
+        return -ENOMEM;
+    rv = rb_init(&_mp->rb, size);
+    if (rv < 0) {
+        free(_mp);
+        return rv;
+    }
+    _mp->slot_mask = slots - 1;
+    _mp->rsv = _mp->pub = 0;
+    for (i = 0; i < slots; i++)
+        _mp->slot[i].seq = _mp->slot[i].len = 0;
+    *mp = _mp;
+
+    return 0;
+}
+
+void rbmp_deinit(rbmp_t *mp)
+{
+    rb_deinit(mp->rb);
+    free(mp);
+}
+
+/* -EAGAIN when there is no room or no free slot, nothing is reserved then */
+int rbmp_reserve(rbmp_t *mp, unsigned int size, rbmp_rsv_t *rsv)
+{
+    rb_t *rb = mp->rb;
+    unsigned long long r;
+    unsigned int seq, pos, s;
+
+    if (!size || size > rb->size)
+        return -EINVAL;
+    r = __atomic_load_n(&mp->rsv, __ATOMIC_RELAXED);
+    do {
+        seq = SEQ(r);
+        pos = POS(r);
+        if (pos - rb_smp_out(rb) > rb->size - size)
+            return -EAGAIN;
+        if (seq - SEQ(__atomic_load_n(&mp->pub, __ATOMIC_ACQUIRE)) > mp->slot_mask)
+            return -EAGAIN;
+    } while (!__atomic_compare_exchange_n(&mp->rsv, &r, PACK(seq + 1, pos + size), 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    rsv->seq = seq;
+    rsv->len = size;
+    s = min(size, rb->size - (pos & rb->mask));
+    rsv->iov[0].iov_base = rb->buffer + (pos & rb->mask);
+    rsv->iov[0].iov_len = s;
+    rsv->iov[1].iov_base = rb->buffer;
+    rsv->iov[1].iov_len = size - s;
+    rsv->iov_cnt = size > s ? 2 : 1;
+
+    return 0;
+}
+
+void rbmp_commit(rbmp_t *mp, const rbmp_rsv_t *rsv)
+{
+    rbmp_slot_t *slot = &mp->slot[rsv->seq & mp->slot_mask];
+
+    __atomic_store_n(&slot->len, rsv->len, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, rsv->seq + 1, __ATOMIC_SEQ_CST);
+    publish(mp);
+}
+
+/* All or nothing */
+unsigned int rbmp_puts(rbmp_t *mp, const unsigned char *buf, unsigned int size)
+{
+    rbmp_rsv_t rsv;
+
+    if (rbmp_reserve(mp, size, &rsv) < 0)
+        return 0;
+    rb_memcpy(rsv.iov[0].iov_base, buf, rsv.iov[0].iov_len);
+    rb_memcpy(rsv.iov[1].iov_base, buf + rsv.iov[0].iov_len, rsv.iov[1].iov_len);
+    rbmp_commit(mp, &rsv);
+
+    return size;
+}
+
+/* Bring rb->in up to the committed prefix, then the rb_consumer_* and rb_peek_* calls see it */
+unsigned int rbmp_sync(rbmp_t *mp)
+{
+    mp->rb->in = POS(__atomic_load_n(&mp->pub, __ATOMIC_ACQUIRE));
+
+    return rb_used_size(mp->rb);
+}
+
+unsigned int rbmp_gets(rbmp_t *mp, unsigned char *buf, unsigned int size)
+{
+    rb_t *rb = mp->rb;
+    unsigned int used_size, roll_size, s;
+
+    used_size = rbmp_sync(mp);
+    size = min(size, used_size);
+    if (!size)
+        return 0;
+    roll_size = rb->size - (rb->out & rb->mask);
+    s = min(size, roll_size);
+    rb_memcpy(buf, rb->buffer + (rb->out & rb->mask), s);
+    rb_memcpy(buf + s, rb->buffer, size - s);
+    rb_smp_consumed(rb, size);
+
+    return size;
+}
+
+static int is_power_of_2(unsigned long n)
+{
+    return (n != 0 && ((n & (n - 1)) == 0));
+}
+
+/* A stale p only makes the CAS fail, seq never repeats within the slot window */
+static void publish(rbmp_t *mp)
+{
+    unsigned long long p;
+    rbmp_slot_t *slot;
+    unsigned int seq, len;
+
+    p = __atomic_load_n(&mp->pub, __ATOMIC_SEQ_CST);
+    for (;;) {
+        seq = SEQ(p);
+        slot = &mp->slot[seq & mp->slot_mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != seq + 1)
+            break;
+        len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+        __atomic_compare_exchange_n(&mp->pub, &p, PACK(seq + 1, POS(p) + len), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        /* on success p is stale, reload it; on failure it was reloaded */
+        p = __atomic_load_n(&mp->pub, __ATOMIC_SEQ_CST);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBMP_H__
+#define __RBMP_H__
+
+#include "ringbuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rbmp_slot_t{
+    unsigned int seq;           /* seq + 1 of the reservation committed here */
+    unsigned int len;
+} rbmp_slot_t;
+
+/*
+ * Many producer threads, one consumer thread. A producer reserves a byte
+ * range, fills it without any lock and commits; commits may come in any
+ * order, the consumer sees only the contiguous committed prefix.
+ */
+typedef struct rbmp_t{
+    rb_t *rb;                   /* rb->in is the consumer's copy of the prefix, see rbmp_sync */
+    unsigned int slot_mask;
+    unsigned long long rsv __attribute__((aligned(64)));   /* seq << 32 | pos of the next reservation */
+    unsigned long long pub __attribute__((aligned(64)));   /* seq << 32 | in of the committed prefix */
+    rbmp_slot_t slot[0] __attribute__((aligned(64)));
+} rbmp_t;
+
+typedef struct rbmp_rsv_t{
+    unsigned int seq;
+    unsigned int len;
+    unsigned int iov_cnt;
+    struct iovec iov[2];        /* the second one is the part after the wrap */
+} rbmp_rsv_t;
+
+int rbmp_init(rbmp_t **mp, unsigned int size, unsigned int slots);
+void rbmp_deinit(rbmp_t *mp);
+/* producers */
+int rbmp_reserve(rbmp_t *mp, unsigned int size, rbmp_rsv_t *rsv);
+void rbmp_commit(rbmp_t *mp, const rbmp_rsv_t *rsv);
+unsigned int rbmp_puts(rbmp_t *mp, const unsigned char *buf, unsigned int size);
+/* consumer */
+unsigned int rbmp_sync(rbmp_t *mp);
+unsigned int rbmp_gets(rbmp_t *mp, unsigned char *buf, unsigned int size);
+#define rbmp_consumed(mp, size) rb_smp_consumed((mp)->rb, size)
+#define rbmp_rb(mp)             ((mp)->rb)
+#define rbmp_slots(mp)          ((mp)->slot_mask + 1)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RBMP_H__ */
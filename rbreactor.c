@@ -0,0 +1,476 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* edge triggered epoll driver for per connection read/write buffers */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "rbreactor.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define F_DIRTY     0x01    /* on the dirty list, flushed after the batch */
+#define F_DEAD      0x02    /* closed, freed after the batch */
+#define F_RBLOCKED  0x04    /* read buffer full, waiting for rbreactor_resume */
+#define F_EOF       0x08    /* the peer has shut down its side */
+
+static int recvfd(void *ptr, void *buf, unsigned int size);
+static int sendfd(void *ptr, const void *buf, unsigned int size);
+static int readvfd(void *ptr, void *buf, unsigned int cnt);
+static int writevfd(void *ptr, const void *buf, unsigned int cnt);
+static int add_conn(rbreactor_t *r, rbconn_t *c);
+static void free_conn(rbconn_t *c);
+static void handle_accept(rbconn_t *c);
+static void handle_read(rbconn_t *c);
+static int arm(rbconn_t *c, unsigned int events);
+
+int rbreactor_init(rbreactor_t **r, unsigned int max_events)
+{
+    rbreactor_t *_r;
+
+    if (!max_events)
+        return -EINVAL;
+    _r = (rbreactor_t *)malloc(sizeof(*_r) + sizeof(_r->events[0]) * max_events);
+    if (!_r)
+        return -ENOMEM;
+    _r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_r->epfd < 0) {
+        free(_r);
+        return -errno;
+    }
+    _r->stop = 0;
+    _r->max_events = max_events;
+    _r->conn_num = 0;
+    _r->dirty = _r->dead = NULL;
+    *r = _r;
+
+    return 0;
+}
+
+/* Connections still registered belong to the caller, close them first */
+void rbreactor_deinit(rbreactor_t *r)
+{
+    rbconn_t *c;
+
+    while ((c = r->dead) != NULL) {
+        r->dead = c->dead_next;
+        free_conn(c);
+    }
+    close(r->epfd);
+    free(r);
+}
+
+int rbreactor_listen(rbreactor_t *r, int fd, rbaccept_pt accept_cb, void *data, rbconn_t **conn)
+{
+    rbconn_t *c;
+    int rv;
+
+    c = (rbconn_t *)calloc(1, sizeof(*c));
+    if (!c)
+        return -ENOMEM;
+    c->fd = fd;
+    c->type = RBCONN_LISTEN;
+    c->accept_cb = accept_cb;
+    c->data = data;
+    rv = add_conn(r, c);
+    if (rv < 0) {
+        free(c);
+        return rv;
+    }
+    if (conn)
+        *conn = c;
+
+    return 0;
+}
+
+int rbreactor_add(rbreactor_t *r,
+    int fd,
+    unsigned int rsize,
+    unsigned int wsize,
+    rbconn_pt read_cb,
+    rbconn_pt close_cb,
+    void *data,
+    rbconn_t **conn)
+{
+    rbconn_t *c;
+    int rv;
+
+    c = (rbconn_t *)calloc(1, sizeof(*c));
+    if (!c)
+        return -ENOMEM;
+    c->fd = fd;
+    c->type = RBCONN_RB;
+    rv = rb_init(&c->rbuf.rb, rsize);
+    if (rv < 0)
+        goto ERR;
+    rv = rb_init(&c->wbuf.rb, wsize);
+    if (rv < 0)
+        goto ERR;
+    c->read_cb = read_cb;
+    c->close_cb = close_cb;
+    c->data = data;
+    rv = add_conn(r, c);
+    if (rv < 0)
+        goto ERR;
+    if (conn)
+        *conn = c;
+
+    return 0;
+
+ERR:
+    free_conn(c);
+    return rv;
+}
+
+int rbreactor_addv(rbreactor_t *r,
+    int fd,
+    unsigned int max_num,
+    unsigned int ele_size,
+    rbconn_pt read_cb,
+    rbconn_pt close_cb,
+    void *data,
+    rbconn_t **conn)
+{
+    rbconn_t *c;
+    int rv;
+
+    c = (rbconn_t *)calloc(1, sizeof(*c));
+    if (!c)
+        return -ENOMEM;
+    c->fd = fd;
+    c->type = RBCONN_RBVEC;
+    rv = rbvec_init(&c->rbuf.rbv, max_num, ele_size);
+    if (rv < 0)
+        goto ERR;
+    rv = rbvec_init(&c->wbuf.rbv, max_num, ele_size);
+    if (rv < 0)
+        goto ERR;
+    c->read_cb = read_cb;
+    c->close_cb = close_cb;
+    c->data = data;
+    rv = add_conn(r, c);
+    if (rv < 0)
+        goto ERR;
+    if (conn)
+        *conn = c;
+
+    return 0;
+
+ERR:
+    free_conn(c);
+    return rv;
+}
+
+/* Safe inside callbacks, the memory is released after the current batch */
+void rbreactor_close(rbconn_t *conn)
+{
+    rbreactor_t *r = conn->reactor;
+
+    if (conn->flags & F_DEAD)
+        return;
+    conn->flags |= F_DEAD;
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    if (conn->close_cb)
+        conn->close_cb(conn);
+    close(conn->fd);
+    r->conn_num--;
+    conn->dead_next = r->dead;
+    r->dead = conn;
+}
+
+unsigned int rbreactor_puts(rbconn_t *conn, const unsigned char *buf, unsigned int size)
+{
+    unsigned int s;
+
+    if (conn->type == RBCONN_RB)
+        s = rb_puts(conn->wbuf.rb, buf, size);
+    else
+        s = rbvec_puts(conn->wbuf.rbv, buf, size);
+    if (s)
+        rbreactor_mark(conn);
+
+    return s;
+}
+
+/* Queue the connection to be flushed once the current batch of events is handled */
+void rbreactor_mark(rbconn_t *conn)
+{
+    rbreactor_t *r = conn->reactor;
+
+    if (conn->flags & (F_DIRTY | F_DEAD))
+        return;
+    conn->flags |= F_DIRTY;
+    conn->dirty_next = r->dirty;
+    r->dirty = conn;
+}
+
+/* EPOLLOUT stays armed only while the write buffer holds data */
+int rbreactor_flush(rbconn_t *conn)
+{
+    unsigned int wrote = 0;
+    int rv = 0;
+
+    if (conn->flags & F_DEAD)
+        return -EBADF;
+    if (rbconn_used_size(conn, wbuf)) {
+        if (conn->type == RBCONN_RB)
+            rv = rb_write(conn->wbuf.rb, sendfd, &conn->fd, &wrote);
+        else
+            rv = rbvec_write(conn->wbuf.rbv, writevfd, &conn->fd, &wrote);
+        if (rv < 0 && rv != -EAGAIN) {
+            rbreactor_close(conn);
+            return rv;
+        }
+    }
+    if (rbconn_used_size(conn, wbuf))
+        rv = arm(conn, conn->events | EPOLLOUT);
+    else
+        rv = arm(conn, conn->events & ~EPOLLOUT);
+    if (rv < 0)
+        rbreactor_close(conn);
+
+    return rv;
+}
+
+/* Edge triggered reads stop when the read buffer fills, restart them once it is drained */
+void rbreactor_resume(rbconn_t *conn)
+{
+    if (!(conn->flags & F_RBLOCKED) || (conn->flags & F_DEAD))
+        return;
+    conn->flags &= ~F_RBLOCKED;
+    handle_read(conn);
+}
+
+/* One epoll_wait, all ready connections are serviced before any write is flushed */
+int rbreactor_poll(rbreactor_t *r, int timeout)
+{
+    rbconn_t *c;
+    int n, i;
+
+    n = epoll_wait(r->epfd, r->events, r->max_events, timeout);
+    if (n < 0)
+        return errno == EINTR ? 0 : -errno;
+    for (i = 0; i < n; i++) {
+        unsigned int ev = r->events[i].events;
+
+        c = (rbconn_t *)r->events[i].data.ptr;
+        if (c->flags & F_DEAD)
+            continue;
+        if (c->type == RBCONN_LISTEN) {
+            handle_accept(c);
+            continue;
+        }
+        if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            handle_read(c);
+        if ((ev & EPOLLOUT) && !(c->flags & F_DEAD))
+            rbreactor_mark(c);
+    }
+    while ((c = r->dirty) != NULL) {
+        r->dirty = c->dirty_next;
+        c->flags &= ~F_DIRTY;
+        if (!(c->flags & F_DEAD))
+            rbreactor_flush(c);
+    }
+    while ((c = r->dead) != NULL) {
+        r->dead = c->dead_next;
+        free_conn(c);
+    }
+
+    return n;
+}
+
+int rbreactor_run(rbreactor_t *r)
+{
+    int rv;
+
+    r->stop = 0;
+    while (!r->stop) {
+        rv = rbreactor_poll(r, -1);
+        if (rv < 0)
+            return rv;
+    }
+
+    return 0;
+}
+
+static int recvfd(void *ptr, void *buf, unsigned int size)
+{
+    rbconn_t *c = (rbconn_t *)ptr;
+    int rv;
+
+    do {
+        rv = recv(c->fd, buf, size, 0);
+    } while (rv < 0 && errno == EINTR);
+    if (rv == 0)
+        c->flags |= F_EOF;
+    if (rv < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -EAGAIN;
+        else
+            return -errno;
+    }
+
+    return rv;
+}
+
+static int sendfd(void *ptr, const void *buf, unsigned int size)
+{
+    int fd, rv;
+
+    fd = *(int *)ptr;
+    do {
+        rv = send(fd, buf, size, MSG_NOSIGNAL);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -EAGAIN;
+        else
+            return -errno;
+    }
+
+    return rv;
+}
+
+static int readvfd(void *ptr, void *buf, unsigned int cnt)
+{
+    rbconn_t *c = (rbconn_t *)ptr;
+    int rv;
+
+    do {
+        rv = readv(c->fd, (const struct iovec *)buf, cnt);
+    } while (rv < 0 && errno == EINTR);
+    if (rv == 0)
+        c->flags |= F_EOF;
+    if (rv < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -EAGAIN;
+        else
+            return -errno;
+    }
+
+    return rv;
+}
+
+static int writevfd(void *ptr, const void *buf, unsigned int cnt)
+{
+    struct msghdr msg;
+    int fd, rv;
+
+    fd = *(int *)ptr;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)buf;
+    msg.msg_iovlen = cnt;
+    do {
+        rv = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -EAGAIN;
+        else
+            return -errno;
+    }
+
+    return rv;
+}
+
+static int add_conn(rbreactor_t *r, rbconn_t *c)
+{
+    struct epoll_event ev;
+
+    c->reactor = r;
+    c->events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.events = c->events;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        return -errno;
+    r->conn_num++;
+
+    return 0;
+}
+
+static void free_conn(rbconn_t *c)
+{
+    if (c->type == RBCONN_RB) {
+        if (c->rbuf.rb)
+            rb_deinit(c->rbuf.rb);
+        if (c->wbuf.rb)
+            rb_deinit(c->wbuf.rb);
+    } else if (c->type == RBCONN_RBVEC) {
+        if (c->rbuf.rbv)
+            rbvec_deinit(c->rbuf.rbv);
+        if (c->wbuf.rbv)
+            rbvec_deinit(c->wbuf.rbv);
+    }
+    free(c);
+}
+
+static void handle_accept(rbconn_t *c)
+{
+    int fd;
+
+    for (;;) {
+        fd = accept4(c->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        c->accept_cb(c->reactor, fd, c->data);
+    }
+}
+
+/* Read until -EAGAIN, the edge is not reported again */
+static void handle_read(rbconn_t *c)
+{
+    unsigned int read;
+    int rv;
+
+    for (;;) {
+        read = 0;
+        if (c->type == RBCONN_RB)
+            rv = rb_read(c->rbuf.rb, recvfd, c, &read);
+        else
+            rv = rbvec_read(c->rbuf.rbv, readvfd, c, &read);
+        if (read && c->read_cb) {
+            c->read_cb(c);
+            if (c->flags & F_DEAD)
+                return;
+        }
+        if (rv == -EAGAIN)
+            return;
+        if (rv < 0)
+            break;
+        if (rv == 0) {
+            if (c->flags & F_EOF)
+                break;
+            /* no room left in the read buffer */
+            if (!read) {
+                c->flags |= F_RBLOCKED;
+                return;
+            }
+        }
+    }
+    rbreactor_close(c);
+}
+
+static int arm(rbconn_t *c, unsigned int events)
+{
+    struct epoll_event ev;
+
+    if (events == c->events)
+        return 0;
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl(c->reactor->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+        return -errno;
+    c->events = events;
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBREACTOR_H__
+#define __RBREACTOR_H__
+
+#include "ringbuffer.h"
+#include <sys/epoll.h>
+
+#define RBCONN_RB       0
+#define RBCONN_RBVEC    1
+#define RBCONN_LISTEN   2
+
+typedef struct rbreactor_t rbreactor_t;
+typedef struct rbconn_t rbconn_t;
+typedef void(*rbconn_pt)(rbconn_t *);
+typedef void(*rbaccept_pt)(rbreactor_t *, int, void *);
+
+struct rbconn_t{
+    int fd;
+    int type;
+    unsigned int events;
+    unsigned int flags;
+    union {
+        rb_t *rb;
+        rbvec_t *rbv;
+    } rbuf, wbuf;
+    rbconn_pt read_cb;
+    rbconn_pt close_cb;
+    rbaccept_pt accept_cb;
+    void *data;
+    rbreactor_t *reactor;
+    rbconn_t *dirty_next;
+    rbconn_t *dead_next;
+};
+
+struct rbreactor_t{
+    int epfd;
+    int stop;
+    unsigned int max_events;
+    unsigned int conn_num;
+    rbconn_t *dirty;
+    rbconn_t *dead;
+    struct epoll_event events[0];
+};
+
+int rbreactor_init(rbreactor_t **r, unsigned int max_events);
+void rbreactor_deinit(rbreactor_t *r);
+int rbreactor_listen(rbreactor_t *r, int fd, rbaccept_pt accept_cb, void *data, rbconn_t **conn);
+int rbreactor_add(rbreactor_t *r,
+    int fd,
+    unsigned int rsize,
+    unsigned int wsize,
+    rbconn_pt read_cb,
+    rbconn_pt close_cb,
+    void *data,
+    rbconn_t **conn);
+int rbreactor_addv(rbreactor_t *r,
+    int fd,
+    unsigned int max_num,
+    unsigned int ele_size,
+    rbconn_pt read_cb,
+    rbconn_pt close_cb,
+    void *data,
+    rbconn_t **conn);
+void rbreactor_close(rbconn_t *conn);
+unsigned int rbreactor_puts(rbconn_t *conn, const unsigned char *buf, unsigned int size);
+void rbreactor_mark(rbconn_t *conn);
+int rbreactor_flush(rbconn_t *conn);
+void rbreactor_resume(rbconn_t *conn);
+int rbreactor_poll(rbreactor_t *r, int timeout);
+int rbreactor_run(rbreactor_t *r);
+#define rbreactor_stop(r)       ((r)->stop = 1)
+#define rbreactor_conn_num(r)   ((r)->conn_num)
+#define rbconn_used_size(c, buf)                                        \
+    ((c)->type == RBCONN_RB ? rb_used_size((c)->buf.rb) : rbvec_used_size((c)->buf.rbv))
+
+#endif /* __RBREACTOR_H__ */
@@ -0,0 +1,234 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* per-core rb_t shards, one producer per shard, consumers steal when idle */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "rbshard.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sched.h>
+
+#ifndef min
+#define min(a,b)    (((a) < (b)) ? (a) : (b))
+#endif
+
+static int take_batch(rb_t *rb, unsigned char *buf, unsigned int size);
+
+int rbshard_init(rbshard_t **rbs, unsigned int num, unsigned int size)
+{
+    rbshard_t *_rbs;
+    unsigned int i;
+    int rv;
+
+    if (!num || size < RBSHARD_HDR_SIZE)
+        return -EINVAL;
+    if (posix_memalign((void **)&_rbs, 64, sizeof(*_rbs) + sizeof(_rbs->shard[0]) * num))
+        return -ENOMEM;
+    memset(_rbs, 0, sizeof(*_rbs) + sizeof(_rbs->shard[0]) * num);
+    _rbs->num = num;
+    _rbs->steal_size = size >> 1;
+    for (i = 0; i < num; i++) {
+        rv = rb_init(&_rbs->shard[i].rb, size);
+        if (rv < 0) {
+            _rbs->num = i;
+            rbshard_deinit(_rbs);
+            return rv;
+        }
+        pthread_spin_init(&_rbs->shard[i].plock, PTHREAD_PROCESS_PRIVATE);
+        pthread_spin_init(&_rbs->shard[i].clock, PTHREAD_PROCESS_PRIVATE);
+    }
+    *rbs = _rbs;
+
+    return 0;
+}
+
+void rbshard_deinit(rbshard_t *rbs)
+{
+    unsigned int i;
+
+    for (i = 0; i < rbs->num; i++) {
+        pthread_spin_destroy(&rbs->shard[i].plock);
+        pthread_spin_destroy(&rbs->shard[i].clock);
+        rb_deinit(rbs->shard[i].rb);
+    }
+    free(rbs);
+}
+
+unsigned int rbshard_local(rbshard_t *rbs)
+{
+    int cpu;
+
+    cpu = sched_getcpu();
+    if (cpu < 0)
+        return 0;
+
+    return (unsigned int)cpu % rbs->num;
+}
+
+/* The whole record or nothing, so a batch never splits a record; -EMSGSIZE when it can never fit */
+int rbshard_put(rbshard_t *rbs, unsigned int idx, const unsigned char *buf, unsigned int size)
+{
+    rbshard_slot_t *slot;
+    rb_t *rb;
+    unsigned int rec_size, pos, s;
+
+    slot = &rbs->shard[idx];
+    rb = slot->rb;
+    /* before rbshard_rec_size, which wraps near UINT_MAX */
+    if (size > rb->size - RBSHARD_HDR_SIZE)
+        return -EMSGSIZE;
+    rec_size = rbshard_rec_size(size);
+    pthread_spin_lock(&slot->plock);
+    if (rec_size > rb->size - (rb->in - rb_smp_out(rb))) {
+        slot->stats.put_fails++;
+        pthread_spin_unlock(&slot->plock);
+        return -ENOBUFS;
+    }
+    /* records are 4 bytes aligned, the header never wraps */
+    pos = rb->in & rb->mask;
+    memcpy(rb->buffer + pos, &size, RBSHARD_HDR_SIZE);
+    pos = (pos + RBSHARD_HDR_SIZE) & rb->mask;
+    s = min(size, rb->size - pos);
+    memcpy(rb->buffer + pos, buf, s);
+    memcpy(rb->buffer, buf + s, size - s);
+    rb_smp_produced(rb, rec_size);
+    slot->stats.puts++;
+    slot->stats.put_bytes += size;
+    pthread_spin_unlock(&slot->plock);
+
+    return 0;
+}
+
+/*
+ * Drain own shard first, steal a batch from the fullest other shard when it
+ * is empty. -EMSGSIZE when the head record of the own shard does not fit in
+ * size; a victim whose head record does not fit is skipped.
+ */
+int rbshard_gets(rbshard_t *rbs, unsigned int idx, unsigned char *buf, unsigned int size)
+{
+    rbshard_slot_t *slot, *victim;
+    unsigned int used, max_used, i, first;
+    int got;
+
+    slot = &rbs->shard[idx];
+    pthread_spin_lock(&slot->clock);
+    got = take_batch(slot->rb, buf, size);
+    pthread_spin_unlock(&slot->clock);
+    if (got < 0)
+        return got;
+    if (got) {
+        slot->stats.gets++;
+        slot->stats.get_bytes += got;
+        return got;
+    }
+
+    first = idx;
+    max_used = 0;
+    for (i = 0; i < rbs->num; i++) {
+        if (i == idx)
+            continue;
+        used = rb_smp_in(rbs->shard[i].rb) - rb_smp_out(rbs->shard[i].rb);
+        if (used > max_used) {
+            max_used = used;
+            first = i;
+        }
+    }
+    if (first == idx)
+        return 0;
+    /* the fullest one, then the ones after it */
+    for (i = 0; i < rbs->num; i++) {
+        if ((first + i) % rbs->num == idx)
+            continue;
+        victim = &rbs->shard[(first + i) % rbs->num];
+        if (pthread_spin_trylock(&victim->clock))
+            continue;
+        got = take_batch(victim->rb, buf, min(size, rbs->steal_size));
+        pthread_spin_unlock(&victim->clock);
+        if (got > 0) {
+            slot->stats.gets++;
+            slot->stats.get_bytes += got;
+            slot->stats.steals++;
+            slot->stats.stolen_bytes += got;
+            return got;
+        }
+    }
+
+    return 0;
+}
+
+unsigned int rbshard_used_size(rbshard_t *rbs)
+{
+    unsigned int i, used;
+
+    for (used = 0, i = 0; i < rbs->num; i++)
+        used += rb_smp_in(rbs->shard[i].rb) - rb_smp_out(rbs->shard[i].rb);
+
+    return used;
+}
+
+void rbshard_stats(rbshard_t *rbs, rbshard_stats_t *total)
+{
+    unsigned int i;
+
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < rbs->num; i++) {
+        rbshard_stats_t *s = &rbs->shard[i].stats;
+
+        total->puts += s->puts;
+        total->put_bytes += s->put_bytes;
+        total->put_fails += s->put_fails;
+        total->gets += s->gets;
+        total->get_bytes += s->get_bytes;
+        total->steals += s->steals;
+        total->stolen_bytes += s->stolen_bytes;
+    }
+}
+
+/* Jain's index over bytes taken by each consumer, 1.0 is perfectly even */
+double rbshard_fairness(rbshard_t *rbs)
+{
+    double sum, sum_sq, x;
+    unsigned int i;
+
+    for (sum = sum_sq = 0, i = 0; i < rbs->num; i++) {
+        x = (double)rbs->shard[i].stats.get_bytes;
+        sum += x;
+        sum_sq += x * x;
+    }
+    if (sum_sq == 0)
+        return 1.0;
+
+    return (sum * sum) / (rbs->num * sum_sq);
+}
+
+/*
+ * Copy out as many whole records as fit in buf, the caller holds the consumer
+ * lock. -EMSGSIZE when not even the head record fits.
+ */
+static int take_batch(rb_t *rb, unsigned char *buf, unsigned int size)
+{
+    unsigned int used, batch, rec_len, s;
+
+    used = rb_smp_in(rb) - rb->out;
+    for (batch = 0; batch < used; batch += rbshard_rec_size(rec_len)) {
+        memcpy(&rec_len, rb->buffer + ((rb->out + batch) & rb->mask), RBSHARD_HDR_SIZE);
+        if (batch + rbshard_rec_size(rec_len) > size)
+            break;
+    }
+    if (!batch)
+        return used ? -EMSGSIZE : 0;
+    assert(batch <= used);
+    s = min(batch, rb->size - (rb->out & rb->mask));
+    memcpy(buf, rb->buffer + (rb->out & rb->mask), s);
+    memcpy(buf + s, rb->buffer, batch - s);
+    rb_smp_consumed(rb, batch);
+
+    return (int)batch;
+}
@@ -0,0 +1,52 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+#ifndef __RBSHARD_H__
+#define __RBSHARD_H__
+
+#include "ringbuffer.h"
+#include <pthread.h>
+
+typedef struct rbshard_stats_t{
+    unsigned long long puts;
+    unsigned long long put_bytes;
+    unsigned long long put_fails;
+    unsigned long long gets;
+    unsigned long long get_bytes;
+    unsigned long long steals;
+    unsigned long long stolen_bytes;
+} rbshard_stats_t;
+
+typedef struct rbshard_slot_t{
+    rb_t *rb;
+    pthread_spinlock_t plock;
+    pthread_spinlock_t clock;
+    rbshard_stats_t stats;
+} __attribute__((aligned(64))) rbshard_slot_t;
+
+typedef struct rbshard_t{
+    unsigned int num;
+    unsigned int steal_size;
+    rbshard_slot_t shard[0];
+} rbshard_t;
+
+int rbshard_init(rbshard_t **rbs, unsigned int num, unsigned int size);
+void rbshard_deinit(rbshard_t *rbs);
+unsigned int rbshard_local(rbshard_t *rbs);
+int rbshard_put(rbshard_t *rbs, unsigned int idx, const unsigned char *buf, unsigned int size);
+int rbshard_gets(rbshard_t *rbs, unsigned int idx, unsigned char *buf, unsigned int size);
+unsigned int rbshard_used_size(rbshard_t *rbs);
+void rbshard_stats(rbshard_t *rbs, rbshard_stats_t *total);
+double rbshard_fairness(rbshard_t *rbs);
+#define rbshard_num(rbs)                ((rbs)->num)
+#define rbshard_set_steal_size(rbs, s)  ((rbs)->steal_size = (s))
+/* records returned by rbshard_gets: unsigned int length, payload, padding to 4 bytes */
+#define RBSHARD_HDR_SIZE                sizeof(unsigned int)
+#define rbshard_rec_size(len)           ((RBSHARD_HDR_SIZE + (len) + 3) & ~3U)
+#define rbshard_rec_len(p)              (*(const unsigned int *)(p))
+#define rbshard_rec_data(p)             ((const unsigned char *)(p) + RBSHARD_HDR_SIZE)
+#define rbshard_rec_next(p)             ((const unsigned char *)(p) + rbshard_rec_size(rbshard_rec_len(p)))
+
+#endif /* __RBSHARD_H__ */
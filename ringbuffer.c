@@ -5,44 +5,248 @@
 
 /* inspired by linux kfifo */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "ringbuffer.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef min
 #define min(a,b)    (((a) < (b)) ? (a) : (b))
 #endif
 
 static int is_power_of_2(unsigned long n);
+static rb_t *rb_setup(void *mem, unsigned int size, int fd, unsigned int map_size);
+static void *memfd_map(int fd, unsigned long long offset, unsigned long long *len);
+static int rb_map(rb_t **rb, int fd, unsigned long long offset, unsigned long long file_size);
+static unsigned long long vec_hdr_size(unsigned int max_num);
+static int chunk_alloc(rbvec_t *rbv, unsigned int idx, unsigned int cnt, int slab);
+static unsigned int chunk_consumer_peek_at(rbvec_chunk_t *c, unsigned int offset, unsigned int size, unsigned char **buf);
+static unsigned int chunk_producer_peek_at(rbvec_chunk_t *c, unsigned int offset, unsigned int size, unsigned char **buf);
+static int wm_init(rb_wm_t **wm, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr, unsigned int used);
+static unsigned int rb_release(rb_t *rb, unsigned int from, unsigned int to);
+static unsigned int iov_size(const struct iovec *iov, unsigned int iov_cnt, unsigned int limit);
+static void iov_copy(const struct iovec *dst, unsigned int dst_cnt, const struct iovec *src, unsigned int src_cnt);
 
 int rb_init(rb_t **rb, unsigned int size)
 {
+    unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+    unsigned char *mem;
     rb_t *_rb;
 
     /* alloc_size must be a power of 2 */
     if (!is_power_of_2(size))
         return -EINVAL;
+    /* the header ends a page of its own, the buffer starts on the next one */
+    if (size >= RB_MMAP_THRESHOLD && size >= page) {
+        mem = (unsigned char *)mmap(NULL, page + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return -ENOMEM;
+        *rb = rb_setup(mem + page - offsetof(rb_t, buffer), size, -1, (unsigned int)(page + size));
+        return 0;
+    }
     _rb = (rb_t *)malloc(sizeof(*_rb) + size);
     if (!_rb)
         return -ENOMEM;
-    _rb->size = size;
-    _rb->in = _rb->out = 0;
-    _rb->mask = size - 1;
-    *rb = _rb;
+    *rb = rb_setup(_rb, size, -1, 0);
 
     return 0;
 }
 
+/* Same as rb_init, but the header and the buffer are a MAP_SHARED memfd that can outlive the process */
+int rb_init_memfd(rb_t **rb, unsigned int size)
+{
+    unsigned long long len = sizeof(rb_t) + (unsigned long long)size;
+    void *mem;
+    int fd, rv;
+
+    if (!is_power_of_2(size))
+        return -EINVAL;
+    fd = memfd_create("rb", MFD_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    mem = memfd_map(fd, 0, &len);
+    if (!mem) {
+        rv = -errno;
+        close(fd);
+        return rv;
+    }
+    *rb = rb_setup(mem, size, fd, (unsigned int)len);
+
+    return 0;
+}
+
+/* Map a rb_init_memfd buffer passed in from another process, in and out are kept, the watermark is not */
+int rb_attach(rb_t **rb, int fd)
+{
+    struct stat st;
+    int rv;
+
+    if (fstat(fd, &st) < 0)
+        return -errno;
+    rv = rb_map(rb, fd, 0, (unsigned long long)st.st_size);
+    if (rv < 0)
+        return rv;
+    (*rb)->fd = fd;
+
+    return 0;
+}
+
+/* Nothing is live afterwards, so a page aligned buffer is released as a whole */
 void rb_reinit(rb_t *rb)
 {
     rb->in = rb->out = 0;
+    rb_wm_check(rb);
+    rb_reclaim(rb);
 }
 
 void rb_deinit(rb_t *rb)
 {
-    free(rb);
+    int fd;
+
+    if (rb->fd < 0) {
+        free(rb->wm);
+        free(rb->idle);
+        if (rb->map_size)
+            munmap(rb->buffer - sysconf(_SC_PAGESIZE), rb->map_size);
+        else
+            free(rb);
+        return;
+    }
+    fd = rb_detach(rb);
+    if (fd >= 0)
+        close(fd);
+}
+
+/*
+ * Unmap a rb_init_memfd/rb_attach buffer and hand its memfd to the caller,
+ * which sends it to the next process and closes it. Detaching before sending
+ * means the two processes never have the header mapped at the same time.
+ */
+int rb_detach(rb_t *rb)
+{
+    int fd = rb->fd;
+
+    if (fd < 0)
+        return -EINVAL;
+    free(rb->wm);
+    free(rb->idle);
+    munmap(rb, rb->map_size);
+
+    return fd;
+}
+
+int rb_set_watermark(rb_t *rb, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr)
+{
+    return wm_init(&rb->wm, low, high, cb, ptr, rb_used_size(rb));
+}
+
+void rb_clear_watermark(rb_t *rb)
+{
+    free(rb->wm);
+    rb->wm = NULL;
+}
+
+/*
+ * madvise the whole pages outside [out, in) away, private mappings read back
+ * zeros and shared memfd pages are punched out of the file. Call it on the
+ * producer's side, the free space only grows under a concurrent consumer.
+ */
+unsigned int rb_reclaim(rb_t *rb)
+{
+    unsigned int pos, free_size, s;
+
+    if (!rb->map_size)
+        return 0;
+    free_size = rb->size - (rb->in - rb_smp_out(rb));
+    if (free_size == rb->size)
+        return rb_release(rb, 0, rb->size);
+    pos = rb->in & rb->mask;
+    s = min(free_size, rb->size - pos);
+
+    return rb_release(rb, pos, pos + s) + rb_release(rb, 0, free_size - s);
+}
+
+int rb_set_reclaim(rb_t *rb, unsigned int low, unsigned int idle_ms)
+{
+    rb_idle_t *idle = rb->idle;
+
+    if (!rb->map_size)
+        return -EINVAL;
+    if (!idle) {
+        idle = (rb_idle_t *)malloc(sizeof(*idle));
+        if (!idle)
+            return -ENOMEM;
+    }
+    idle->low = low;
+    idle->period = idle_ms;
+    idle->busy = 1;
+    idle->since = 0;
+    rb->idle = idle;
+
+    return 0;
+}
+
+void rb_clear_reclaim(rb_t *rb)
+{
+    free(rb->idle);
+    rb->idle = NULL;
+}
+
+/* Called from a timer, reclaims once per period while the buffer stays at or below low */
+unsigned int rb_reclaim_tick(rb_t *rb, unsigned long long now_ms)
+{
+    rb_idle_t *idle = rb->idle;
+
+    if (!idle)
+        return 0;
+    if (rb_used_size(rb) > idle->low) {
+        idle->busy = 1;
+        return 0;
+    }
+    if (idle->busy) {
+        idle->busy = 0;
+        idle->since = now_ms;
+        return 0;
+    }
+    if (now_ms - idle->since < idle->period)
+        return 0;
+    idle->since = now_ms;
+
+    return rb_reclaim(rb);
+}
+
+/* Bytes of the buffer backed by memory right now, rb_size is what is reserved */
+unsigned int rb_resident_size(rb_t *rb)
+{
+    unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+    unsigned char vec[256];
+    uintptr_t lo = (uintptr_t)rb->buffer, hi = lo + rb->size, addr, a, b;
+    unsigned int resident = 0, n, i;
+
+    if (!rb->map_size)
+        return rb->size;
+    for (addr = lo & ~(page - 1); addr < hi; addr += (uintptr_t)n * page) {
+        n = (unsigned int)min((hi - addr + page - 1) / page, sizeof(vec));
+        if (mincore((void *)addr, (size_t)n * page, vec) < 0)
+            return rb->size;
+        for (i = 0; i < n; i++) {
+            if (!(vec[i] & 1))
+                continue;
+            a = addr + (uintptr_t)i * page;
+            b = a + page;
+            resident += (unsigned int)(min(b, hi) - (a > lo ? a : lo));
+        }
+    }
+
+    return resident;
 }
 
 /* Not Zerocopy */
@@ -56,9 +260,10 @@ unsigned int rb_gets(rb_t *rb, unsigned char *buf, unsigned int size)
     roll_size = rb->size - (rb->out & rb->mask);
     size = min(size, used_size);
     s = min(size, roll_size);
-    memcpy(buf, rb->buffer + (rb->out & rb->mask), s);
-    memcpy(buf + s, rb->buffer, size - s);
+    rb_memcpy(buf, rb->buffer + (rb->out & rb->mask), s);
+    rb_memcpy(buf + s, rb->buffer, size - s);
     rb->out += size;
+    rb_wm_check(rb);
 
     return size;
 }
@@ -79,9 +284,10 @@ int rb_get_all(rb_t *rb, unsigned char **buf, unsigned int *buf_size)
     if (!_buf)
         return -ENOMEM;
     s = min(size, roll_size);
-    memcpy(_buf, rb->buffer + (rb->out & rb->mask), s);
-    memcpy(_buf + s, rb->buffer, size - s);
+    rb_memcpy(_buf, rb->buffer + (rb->out & rb->mask), s);
+    rb_memcpy(_buf + s, rb->buffer, size - s);
     rb->out += size;
+    rb_wm_check(rb);
     *buf = _buf;
     *buf_size = size;
 
@@ -99,9 +305,50 @@ unsigned int rb_puts(rb_t *rb, const unsigned char *buf, unsigned int size)
     roll_size = rb->size - (rb->in & rb->mask);
     size = min(size, avail_size);
     s = min(size, roll_size);
-    memcpy(rb->buffer + (rb->in & rb->mask), buf, s);
-    memcpy(rb->buffer, buf + s, size - s);
+    rb_memcpy(rb->buffer + (rb->in & rb->mask), buf, s);
+    rb_memcpy(rb->buffer, buf + s, size - s);
+    rb->in += size;
+    rb_wm_check(rb);
+
+    return size;
+}
+
+/* Not Zerocopy, all or nothing */
+unsigned int rb_getsv(rb_t *rb, const struct iovec *iov, unsigned int iov_cnt)
+{
+    unsigned int size, pos, roll_size, s, i;
+
+    size = iov_size(iov, iov_cnt, rb_used_size(rb));
+    if (!size)
+        return 0;
+    for (pos = rb->out, i = 0; i < iov_cnt; pos += iov[i].iov_len, i++) {
+        roll_size = rb->size - (pos & rb->mask);
+        s = min(iov[i].iov_len, roll_size);
+        rb_memcpy(iov[i].iov_base, rb->buffer + (pos & rb->mask), s);
+        rb_memcpy((unsigned char *)iov[i].iov_base + s, rb->buffer, iov[i].iov_len - s);
+    }
+    rb->out += size;
+    rb_wm_check(rb);
+
+    return size;
+}
+
+/* Not Zerocopy, all or nothing */
+unsigned int rb_putsv(rb_t *rb, const struct iovec *iov, unsigned int iov_cnt)
+{
+    unsigned int size, pos, roll_size, s, i;
+
+    size = iov_size(iov, iov_cnt, rb_avail_size(rb));
+    if (!size)
+        return 0;
+    for (pos = rb->in, i = 0; i < iov_cnt; pos += iov[i].iov_len, i++) {
+        roll_size = rb->size - (pos & rb->mask);
+        s = min(iov[i].iov_len, roll_size);
+        rb_memcpy(rb->buffer + (pos & rb->mask), iov[i].iov_base, s);
+        rb_memcpy(rb->buffer, (const unsigned char *)iov[i].iov_base + s, iov[i].iov_len - s);
+    }
     rb->in += size;
+    rb_wm_check(rb);
 
     return size;
 }
@@ -185,27 +432,214 @@ static int is_power_of_2(unsigned long n)
     return (n != 0 && ((n & (n - 1)) == 0));
 }
 
+static rb_t *rb_setup(void *mem, unsigned int size, int fd, unsigned int map_size)
+{
+    rb_t *rb = (rb_t *)mem;
+
+    rb->size = size;
+    rb->in = rb->out = 0;
+    rb->mask = size - 1;
+    rb->fd = fd;
+    rb->map_size = map_size;
+    rb->wm = NULL;
+    rb->idle = NULL;
+
+    return rb;
+}
+
+/* Grow the file to offset + *len (rounded up to pages) and map that range, NULL with errno set */
+static void *memfd_map(int fd, unsigned long long offset, unsigned long long *len)
+{
+    unsigned long long page = (unsigned long long)sysconf(_SC_PAGESIZE);
+    void *mem;
+
+    *len = (*len + page - 1) & ~(page - 1);
+    if (ftruncate(fd, (off_t)(offset + *len)) < 0)
+        return NULL;
+    mem = mmap(NULL, (size_t)*len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)offset);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    return mem;
+}
+
+/* The header is untrusted, check it against the file before and after mapping */
+static int rb_map(rb_t **rb, int fd, unsigned long long offset, unsigned long long file_size)
+{
+    rb_t hdr, *_rb;
+
+    if (pread(fd, &hdr, sizeof(hdr), (off_t)offset) != (ssize_t)sizeof(hdr))
+        return -EINVAL;
+    if (!is_power_of_2(hdr.size) || hdr.mask != hdr.size - 1 || rb_used_size(&hdr) > hdr.size)
+        return -EINVAL;
+    if (hdr.map_size < sizeof(hdr) + (unsigned long long)hdr.size || offset + hdr.map_size > file_size)
+        return -EINVAL;
+    _rb = (rb_t *)mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)offset);
+    if (_rb == MAP_FAILED)
+        return -errno;
+    if (memcmp(_rb, &hdr, offsetof(rb_t, wm))) {
+        munmap(_rb, hdr.map_size);
+        return -EINVAL;
+    }
+    _rb->fd = -1;
+    _rb->wm = NULL;
+    _rb->idle = NULL;
+    *rb = _rb;
+
+    return 0;
+}
+
+static int wm_init(rb_wm_t **wm, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr, unsigned int used)
+{
+    rb_wm_t *_wm;
+
+    if (low >= high || !cb)
+        return -EINVAL;
+    _wm = *wm;
+    if (!_wm) {
+        _wm = (rb_wm_t *)malloc(sizeof(*_wm));
+        if (!_wm)
+            return -ENOMEM;
+    }
+    _wm->low = low;
+    _wm->high = high;
+    _wm->above = used >= high;
+    _wm->cb = cb;
+    _wm->ptr = ptr;
+    *wm = _wm;
+
+    return 0;
+}
+
+/* buffer[from, to) shrunk to whole pages */
+static unsigned int rb_release(rb_t *rb, unsigned int from, unsigned int to)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t a = ((uintptr_t)rb->buffer + from + page - 1) & ~(page - 1);
+    uintptr_t b = ((uintptr_t)rb->buffer + to) & ~(page - 1);
+
+    if (a >= b)
+        return 0;
+    if (madvise((void *)a, b - a, rb->fd < 0 ? MADV_DONTNEED : MADV_REMOVE) < 0)
+        return 0;
+
+    return (unsigned int)(b - a);
+}
+
+/* 0 when the total is above limit, iov_len is a size_t and may not fit an unsigned int */
+static unsigned int iov_size(const struct iovec *iov, unsigned int iov_cnt, unsigned int limit)
+{
+    size_t size;
+    unsigned int i;
+
+    for (size = 0, i = 0; i < iov_cnt; i++) {
+        if (iov[i].iov_len > limit - size)
+            return 0;
+        size += iov[i].iov_len;
+    }
+
+    return (unsigned int)size;
+}
+
+/* Copy between two scatter lists, dst must hold at least all of src */
+static void iov_copy(const struct iovec *dst, unsigned int dst_cnt, const struct iovec *src, unsigned int src_cnt)
+{
+    unsigned int i, j, doff, soff, s;
+
+    for (i = j = doff = soff = 0; i < dst_cnt && j < src_cnt; ) {
+        s = min(dst[i].iov_len - doff, src[j].iov_len - soff);
+        rb_memcpy((unsigned char *)dst[i].iov_base + doff, (const unsigned char *)src[j].iov_base + soff, s);
+        doff += s;
+        soff += s;
+        if (doff == dst[i].iov_len) {
+            i++;
+            doff = 0;
+        }
+        if (soff == src[j].iov_len) {
+            j++;
+            soff = 0;
+        }
+    }
+}
+
 int rbvec_init(rbvec_t **rbv, unsigned int max_num, unsigned int ele_size)
 {
-    rb_t *rb;
+    return rbvec_init_policy(rbv, max_num, ele_size, NULL);
+}
+
+#define CHUNK_OWNED     0x01    /* payload malloc'd on its own, not part of a slab */
+
+int rbvec_init_policy(rbvec_t **rbv, unsigned int max_num, unsigned int ele_size, const rbvec_policy_t *policy)
+{
     rbvec_t *_rbv;
+    unsigned long long size, max_size, num, chunk_size, next;
+    unsigned int growth_shift, max_ele_size;
     int rv;
 
     /* alloc_size must be a power of 2 */
-    if (!is_power_of_2(max_num))
+    if (!is_power_of_2(max_num) || !is_power_of_2(ele_size))
         return -EINVAL;
-    rv = rb_init(&rb, ele_size);
-    if (rv < 0)
-        return rv;
-    _rbv = (rbvec_t *)malloc(sizeof(*_rbv) + sizeof(void *) * max_num);
-    if (_rbv == NULL)
-        return -ENOMEM;
+    if (policy && policy->max_ele_size && (!is_power_of_2(policy->max_ele_size) || policy->max_ele_size < ele_size))
+        return -EINVAL;
+    if (policy && policy->max_size && policy->max_size < ele_size)
+        return -EINVAL;
+    growth_shift = policy ? policy->growth_shift : 0;
+    max_ele_size = policy && policy->max_ele_size ? policy->max_ele_size : 0x80000000U;
+
+    /* every expansion doubles the chunk count, stop at the first one that does not fit */
+    max_size = policy && policy->max_size ? policy->max_size : 0xffffffffULL;
+    for (size = chunk_size = ele_size, num = 1; num < max_num; num <<= 1, chunk_size = next) {
+        next = chunk_size << growth_shift;
+        if (next > max_ele_size)
+            next = max_ele_size;
+        if (size + num * next > max_size)
+            break;
+        size += num * next;
+    }
+
+    if (policy && (policy->flags & RBVEC_MEMFD)) {
+        /* the whole file is mapped once, chunks are handed out from it in order */
+        unsigned long long map_size = vec_hdr_size(max_num) + size;
+        int fd;
+
+        fd = memfd_create("rbvec", MFD_CLOEXEC);
+        if (fd < 0)
+            return -errno;
+        _rbv = (rbvec_t *)memfd_map(fd, 0, &map_size);
+        if (_rbv == NULL) {
+            rv = -errno;
+            close(fd);
+            return rv;
+        }
+        _rbv->fd = fd;
+        _rbv->map_size = map_size;
+        _rbv->map_used = vec_hdr_size(max_num);
+    } else {
+        _rbv = (rbvec_t *)calloc(1, sizeof(*_rbv) + sizeof(rbvec_chunk_t) * max_num);
+        if (_rbv == NULL)
+            return -ENOMEM;
+        _rbv->fd = -1;
+        _rbv->map_size = _rbv->map_used = 0;
+    }
     _rbv->max_num = max_num;
     _rbv->cnt_bit_offset = 0;
     _rbv->ele_size = ele_size;
     _rbv->in = _rbv->out = 0;
     _rbv->mask = rbvec_num(_rbv) - 1;
-    _rbv->vec[0] = rb;
+    _rbv->flags = policy ? policy->flags : 0;
+    _rbv->growth_shift = growth_shift;
+    _rbv->max_ele_size = max_ele_size;
+    _rbv->chunk_size = ele_size;
+    _rbv->size = ele_size;
+    _rbv->max_size = (unsigned int)size;
+    _rbv->used = 0;
+    _rbv->slab_num = 0;
+    _rbv->wm = NULL;
+    rv = chunk_alloc(_rbv, 0, 1, 1);
+    if (rv < 0) {
+        rbvec_deinit(_rbv);
+        return rv;
+    }
     *rbv = _rbv;
 
     return 0;
@@ -216,19 +650,110 @@ void rbvec_reinit(rbvec_t *rbv)
     unsigned int i;
 
     for (i = 0; i < rbvec_num(rbv); i++)
-        rb_reinit(rbv->vec[i]);
+        rbv->vec[i].in = rbv->vec[i].out = 0;
     rbv->in = rbv->out = 0;
+    rbv->used = 0;
+    rbvec_wm_check(rbv);
 }
 
 void rbvec_deinit(rbvec_t *rbv)
 {
     unsigned int i;
 
+    if (rbv->flags & RBVEC_MEMFD) {
+        close(rbvec_detach(rbv));
+        return;
+    }
     for (i = 0; i < rbvec_num(rbv); i++)
-        rb_deinit(rbv->vec[i]);
+        if (rbv->vec[i].flags & CHUNK_OWNED)
+            free(rbv->vec[i].buffer);
+    for (i = 0; i < rbv->slab_num; i++)
+        free(rbv->slab[i]);
+    free(rbv->wm);
     free(rbv);
 }
 
+/* Like rb_detach, for a RBVEC_MEMFD rbvec_t */
+int rbvec_detach(rbvec_t *rbv)
+{
+    int fd = rbv->fd;
+
+    if (!(rbv->flags & RBVEC_MEMFD))
+        return -EINVAL;
+    free(rbv->wm);
+    munmap(rbv, rbv->map_size);
+
+    return fd;
+}
+
+/* Map a RBVEC_MEMFD rbvec_t passed in from another process, chunks and positions are kept, the watermark is not */
+int rbvec_attach(rbvec_t **rbv, int fd)
+{
+    rbvec_t hdr, *_rbv;
+    rbvec_chunk_t *c;
+    struct stat st;
+    unsigned long long used, size;
+    unsigned int num, window, i;
+    int gap;
+
+    if (fstat(fd, &st) < 0)
+        return -errno;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+        return -EINVAL;
+    if (!(hdr.flags & RBVEC_MEMFD) || !is_power_of_2(hdr.max_num)
+        || hdr.cnt_bit_offset >= 32 || (1U << hdr.cnt_bit_offset) > hdr.max_num
+        || hdr.mask != (1U << hdr.cnt_bit_offset) - 1 || rbvec_used_num(&hdr) > (1U << hdr.cnt_bit_offset)
+        || hdr.map_size != (unsigned long long)st.st_size || hdr.map_used > hdr.map_size
+        || vec_hdr_size(hdr.max_num) > hdr.map_used)
+        return -EINVAL;
+    /* in and out run freely, walking a lap from out must not wrap them */
+    num = 1U << hdr.cnt_bit_offset;
+    if (hdr.out > UINT_MAX - 2 * num
+        || !is_power_of_2(hdr.ele_size) || !is_power_of_2(hdr.chunk_size)
+        || hdr.chunk_size < hdr.ele_size || hdr.chunk_size > hdr.max_ele_size
+        || hdr.size > hdr.max_size || hdr.used > hdr.size)
+        return -EINVAL;
+    _rbv = (rbvec_t *)mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (_rbv == MAP_FAILED)
+        return -errno;
+    if (memcmp(_rbv, &hdr, offsetof(rbvec_t, wm)))
+        goto INVALID;
+    /*
+     * buffer pointers are the old process's, only the offsets carry over.
+     * The data sits in the chunks from out on, up to in, and stops at the
+     * first one that was never allocated; the chunk sizes grew up to chunk_size.
+     */
+    window = rbvec_used_num(&hdr) == num ? num : rbvec_used_num(&hdr) + 1;
+    for (used = size = 0, gap = 0, i = 0; i < num; i++) {
+        c = &_rbv->vec[(hdr.out + i) & hdr.mask];
+        if (!c->size) {
+            if (c->in != c->out)
+                goto INVALID;
+            c->buffer = NULL;
+            gap = 1;
+            continue;
+        }
+        if (!is_power_of_2(c->size) || c->size < hdr.ele_size || c->size > hdr.chunk_size
+            || c->off < vec_hdr_size(hdr.max_num) || c->off + c->size > hdr.map_used
+            || rbvec_chunk_used(c) > c->size || (rbvec_chunk_used(c) && (gap || i >= window)))
+            goto INVALID;
+        c->buffer = (unsigned char *)_rbv + c->off;
+        used += rbvec_chunk_used(c);
+        size += c->size;
+    }
+    if (used != hdr.used || size > hdr.size)
+        goto INVALID;
+    _rbv->fd = fd;
+    _rbv->wm = NULL;
+    *rbv = _rbv;
+
+    return 0;
+
+INVALID:
+    munmap(_rbv, hdr.map_size);
+    return -EINVAL;
+}
+
 unsigned int rbvec_gets(rbvec_t *rbv, unsigned char *buf, unsigned int size)
 {
     struct iovec *vecbuf = NULL;
@@ -244,7 +769,7 @@ unsigned int rbvec_gets(rbvec_t *rbv, unsigned char *buf, unsigned int size)
         unsigned int s, i;
 
         for (s = 0, i = 0; i < vecbuf_cnt; i++) {
-            memcpy(buf + s, vecbuf[i].iov_base, vecbuf[i].iov_len);
+            rb_memcpy(buf + s, vecbuf[i].iov_base, vecbuf[i].iov_len);
             s += vecbuf[i].iov_len;
         }
         assert(s == vecbuf_size);
@@ -274,7 +799,7 @@ int rbvec_get_all(rbvec_t *rbv, unsigned char **buf, unsigned int *buf_size)
         if (!_buf)
             return -ENOMEM;
         for (s = 0, i = 0; i < vecbuf_cnt; i++) {
-            memcpy(_buf + s, vecbuf[i].iov_base, vecbuf[i].iov_len);
+            rb_memcpy(_buf + s, vecbuf[i].iov_base, vecbuf[i].iov_len);
             s += vecbuf[i].iov_len;
         }
         assert(s == vecbuf_size);
@@ -302,7 +827,7 @@ unsigned int rbvec_puts(rbvec_t *rbv, const unsigned char *buf, unsigned int siz
         unsigned int s, i;
 
         for (s = 0, i = 0; i < vecbuf_cnt; i++) {
-            memcpy(vecbuf[i].iov_base, buf + s, vecbuf[i].iov_len);
+            rb_memcpy(vecbuf[i].iov_base, buf + s, vecbuf[i].iov_len);
             s += vecbuf[i].iov_len;
         }
         assert(s == vecbuf_size);
@@ -313,8 +838,128 @@ unsigned int rbvec_puts(rbvec_t *rbv, const unsigned char *buf, unsigned int siz
     return vecbuf_size;
 }
 
-#define new_size(rbv)       ((rbv)->ele_size)
-#define can_expand(rbv)     (rbvec_num(rbv) < rbvec_max_num(rbv))
+/* Not Zerocopy, all or nothing */
+unsigned int rbvec_getsv(rbvec_t *rbv, const struct iovec *iov, unsigned int iov_cnt)
+{
+    struct iovec *vecbuf = NULL;
+    unsigned int vecbuf_cnt = 0, vecbuf_size = 0, size;
+    int rv;
+
+    size = iov_size(iov, iov_cnt, rbvec_used_size(rbv));
+    if (!size)
+        return 0;
+    rv = rbvec_consumer_peek(rbv, size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
+    if (rv < 0)
+        return 0;
+    assert(vecbuf_size == size);
+    iov_copy(iov, iov_cnt, vecbuf, vecbuf_cnt);
+    rbvec_consumed(rbv, size);
+    free(vecbuf);
+
+    return size;
+}
+
+/* Not Zerocopy, all or nothing */
+unsigned int rbvec_putsv(rbvec_t *rbv, const struct iovec *iov, unsigned int iov_cnt)
+{
+    struct iovec *vecbuf = NULL;
+    unsigned int vecbuf_cnt = 0, vecbuf_size = 0, size;
+    int rv;
+
+    size = iov_size(iov, iov_cnt, rbvec_max_size(rbv) - rbvec_used_size(rbv));
+    if (!size)
+        return 0;
+    rv = rbvec_producer_force_peek(rbv, size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
+    if (rv < 0)
+        return 0;
+    if (vecbuf_size == size) {
+        iov_copy(vecbuf, vecbuf_cnt, iov, iov_cnt);
+        rbvec_produced(rbv, size);
+    } else
+        size = 0;
+    free(vecbuf);
+
+    return size;
+}
+
+#define new_size(rbv)       (min((rbv)->chunk_size << (rbv)->growth_shift, (rbv)->max_ele_size))
+#define can_expand(rbv)     (rbvec_size(rbv) < rbvec_max_size(rbv))
+/* in has gone all the way round and shares its chunk with out */
+#define is_lapped(rbv)      (rbvec_used_num(rbv) == (unsigned int)rbvec_num(rbv))
+
+static unsigned long long vec_hdr_size(unsigned int max_num)
+{
+    unsigned long long page = (unsigned long long)sysconf(_SC_PAGESIZE);
+    unsigned long long len;
+
+    len = sizeof(rbvec_t) + sizeof(rbvec_chunk_t) * (unsigned long long)max_num;
+
+    return (len + page - 1) & ~(page - 1);
+}
+
+/* Payload for the chunks idx .. idx + cnt - 1, a slab when eager, a chunk of its own on demand */
+static int chunk_alloc(rbvec_t *rbv, unsigned int idx, unsigned int cnt, int slab)
+{
+    unsigned long long len = (unsigned long long)rbv->chunk_size * cnt;
+    unsigned char *mem;
+    unsigned int i;
+
+    if (rbv->flags & RBVEC_MEMFD) {
+        if (rbv->map_used + len > rbv->map_size)
+            return -ENOMEM;
+        mem = (unsigned char *)rbv + rbv->map_used;
+        rbv->map_used += len;
+    } else {
+        mem = (unsigned char *)malloc(len);
+        if (!mem)
+            return -ENOMEM;
+        if (slab)
+            rbv->slab[rbv->slab_num++] = mem;
+    }
+    for (i = 0; i < cnt; i++) {
+        rbvec_chunk_t *c = &rbv->vec[(idx + i) & rbv->mask];
+
+        c->size = rbv->chunk_size;
+        c->in = c->out = 0;
+        c->flags = !slab && !(rbv->flags & RBVEC_MEMFD) ? CHUNK_OWNED : 0;
+        c->buffer = mem + (unsigned long long)i * rbv->chunk_size;
+        c->off = rbv->flags & RBVEC_MEMFD ? (unsigned long long)(c->buffer - (unsigned char *)rbv) : 0;
+    }
+
+    return 0;
+}
+
+static unsigned int chunk_consumer_peek_at(rbvec_chunk_t *c, unsigned int offset, unsigned int size, unsigned char **buf)
+{
+    unsigned int offset_out, used_size, roll_size, s;
+
+    if (offset >= rbvec_chunk_used(c))
+        return 0;
+    offset_out = c->out + offset;
+    used_size = c->in - offset_out;
+    roll_size = c->size - (offset_out & (c->size - 1));
+    size = min(size, used_size);
+    s = min(size, roll_size);
+    *buf = c->buffer + (offset_out & (c->size - 1));
+
+    return s;
+}
+
+static unsigned int chunk_producer_peek_at(rbvec_chunk_t *c, unsigned int offset, unsigned int size, unsigned char **buf)
+{
+    unsigned int offset_in, avail_size, roll_size, s;
+
+    if (offset >= rbvec_chunk_avail(c))
+        return 0;
+    offset_in = c->in + offset;
+    avail_size = c->size - offset_in + c->out;
+    roll_size = c->size - (offset_in & (c->size - 1));
+    size = min(size, avail_size);
+    s = min(size, roll_size);
+    *buf = c->buffer + (offset_in & (c->size - 1));
+
+    return s;
+}
 
 int rbvec_consumer_peek_at(rbvec_t *rbv,
     unsigned int offset,
@@ -323,7 +968,7 @@ int rbvec_consumer_peek_at(rbvec_t *rbv,
     unsigned int *vecbuf_cnt,
     unsigned int *vecbuf_size)
 {
-    rb_t *rb;
+    rbvec_chunk_t *c;
     unsigned char *buf;
     unsigned int buf_size, remaining;
     unsigned int idx, end;
@@ -333,7 +978,7 @@ int rbvec_consumer_peek_at(rbvec_t *rbv,
     if (!size)
         return 0;
     idx = rbv->out;
-    if (rbvec_is_full(rbv))
+    if (is_lapped(rbv))
         end = rbv->in;
     else
         end = rbv->in + 1;
@@ -341,10 +986,12 @@ int rbvec_consumer_peek_at(rbvec_t *rbv,
     for (; remaining && idx < end; idx++) {
         unsigned int of;
 
-        rb = rbv->vec[idx & rbv->mask];
+        c = &rbv->vec[idx & rbv->mask];
+        if (!c->buffer)
+            break;
         of = offset;
         do {
-            buf_size = rb_consumer_peek_at(rb, of, remaining, &buf);
+            buf_size = chunk_consumer_peek_at(c, of, remaining, &buf);
             if (buf_size) {
                 assert(buf_size <= remaining);
                 vbuf = (struct iovec *)realloc(vbuf, sizeof(*vbuf) * (vbuf_cnt + 1));
@@ -360,8 +1007,8 @@ int rbvec_consumer_peek_at(rbvec_t *rbv,
                 of += buf_size;
                 remaining -= buf_size;
             } else if (buf_size == 0) {
-                if (offset >= rb_used_size(rb))
-                    offset -= rb_used_size(rb);
+                if (offset >= rbvec_chunk_used(c))
+                    offset -= rbvec_chunk_used(c);
             }
         } while (buf_size);
     }
@@ -375,7 +1022,7 @@ LOOP_EXIT:
     return 0;
 }
 
-static producer_peek(rbvec_t *rbv, 
+static int producer_peek(rbvec_t *rbv, 
     unsigned int offset, 
     unsigned int size, 
     struct iovec **vecbuf, 
@@ -383,7 +1030,7 @@ static producer_peek(rbvec_t *rbv,
     unsigned int *vecbuf_size, 
     int forced)
 {
-    rb_t *rb;
+    rbvec_chunk_t *c;
     unsigned char *buf = NULL;
     unsigned int buf_size, remaining;
     unsigned int idx, end;
@@ -400,10 +1047,19 @@ static producer_peek(rbvec_t *rbv,
         for (; remaining && idx < end; idx++) {
             unsigned int of;
 
-            rb = rbv->vec[idx & rbv->mask];
+            c = &rbv->vec[idx & rbv->mask];
+            if (!c->buffer) {
+                int rv;
+
+                rv = chunk_alloc(rbv, idx, 1, 0);
+                if (rv < 0) {
+                    free(vbuf);
+                    return rv;
+                }
+            }
             of = offset;
             do {
-                buf_size = rb_producer_peek_at(rb, of, remaining, &buf);
+                buf_size = chunk_producer_peek_at(c, of, remaining, &buf);
                 if (buf_size) {
                     assert(buf_size <= remaining);
                     vbuf = (struct iovec *)realloc(vbuf, sizeof(*vbuf) * (vbuf_cnt + 1));
@@ -419,31 +1075,44 @@ static producer_peek(rbvec_t *rbv,
                     of += buf_size;
                     remaining -= buf_size;
                 } else if (buf_size == 0) {
-                    if (offset >= rb_avail_size(rb))
-                        offset -= rb_avail_size(rb);
+                    if (offset >= rbvec_chunk_avail(c))
+                        offset -= rbvec_chunk_avail(c);
                 }
             } while (buf_size);
         }
 
         if (can_expand(rbv) && (forced || !expanded)) {
-            unsigned int i, j, n;
+            unsigned int i, n, o;
 
+            /* chunks in front of out move behind the old ones, the new chunks follow them */
             n = rbvec_num(rbv);
-            for (i = 0, j = n; i < n; i++, j++) {
-                int rv;
-
-                rv = rb_init(&rb, new_size(rbv));
-                if (rv < 0)
-                    return rv;
-                rbv->vec[j] = rb;
+            o = rbv->out & rbv->mask;
+            for (i = 0; i < n; i++) {
+                if (i < o) {
+                    rbv->vec[n + i] = rbv->vec[i];
+                    memset(&rbv->vec[i], 0, sizeof(rbv->vec[i]));
+                } else
+                    memset(&rbv->vec[n + i], 0, sizeof(rbv->vec[n + i]));
             }
-            idx = n;
-            rbv->in = rbv->in & rbv->mask;
-            rbv->out = rbv->out & rbv->mask;
+            rbv->in = o + rbvec_used_num(rbv);
+            rbv->out = o;
+            idx = o + n;
             rbv->cnt_bit_offset++;
             rbv->mask = rbvec_num(rbv) - 1;
-            end = rbvec_num(rbv);
+            rbv->chunk_size = new_size(rbv);
+            rbv->size += n * rbv->chunk_size;
+            end = rbv->out + rbvec_num(rbv);
             expanded = 1;
+            /* one slab for the new chunks, after a failure they are allocated one by one when reached */
+            if (!(rbv->flags & RBVEC_LAZY)) {
+                int rv;
+
+                rv = chunk_alloc(rbv, idx, n, 1);
+                if (rv < 0) {
+                    free(vbuf);
+                    return rv;
+                }
+            }
         } else
             break;
     } while (1);
@@ -482,22 +1151,26 @@ unsigned int rbvec_consumed(rbvec_t *rbv, unsigned int size)
     unsigned int idx, end, remaining;
 
     idx = rbv->out;
-    if (rbvec_is_full(rbv))
+    if (is_lapped(rbv))
         end = rbv->in;
     else
         end = rbv->in + 1;
     remaining = size;
     for (; remaining && idx < end; idx++) {
-        rb_t *rb;
+        rbvec_chunk_t *c;
         unsigned int s;
 
-        rb = rbv->vec[idx & rbv->mask];
-        s = min(remaining, rb_used_size(rb));
-        rb_consumed(rb, s);
+        c = &rbv->vec[idx & rbv->mask];
+        if (!c->buffer)
+            break;
+        s = min(remaining, rbvec_chunk_used(c));
+        c->out += s;
         remaining -= s;
-        if (rb_is_empty(rb) && rbv->out < rbv->in)
+        if (c->in == c->out && rbv->out < rbv->in)
             rbv->out++;
     }
+    rbv->used -= size - remaining;
+    rbvec_wm_check(rbv);
 
     return size - remaining;
 }
@@ -510,20 +1183,69 @@ unsigned int rbvec_produced(rbvec_t *rbv, unsigned int size)
     end = rbv->out + rbvec_num(rbv);
     remaining = size;
     for (; remaining && idx < end; idx++) {
-        rb_t *rb;
+        rbvec_chunk_t *c;
         unsigned int s;
 
-        rb = rbv->vec[idx & rbv->mask];
-        s = min(remaining, rb_avail_size(rb));
-        rb_produced(rb, s);
+        c = &rbv->vec[idx & rbv->mask];
+        if (!c->buffer)
+            break;
+        s = min(remaining, rbvec_chunk_avail(c));
+        c->in += s;
         remaining -= s;
-        if (rb_is_full(rb))
+        if (rbvec_chunk_used(c) == c->size)
             rbv->in++;
     }
+    rbv->used += size - remaining;
+    rbvec_wm_check(rbv);
 
     return size - remaining;
 }
 
+int rbvec_peek_copy(rbvec_t *rbv, unsigned int offset, void *dst, unsigned int size)
+{
+    unsigned char *d = (unsigned char *)dst;
+    unsigned int idx, end;
+
+    if (size > rbv->used || offset > rbv->used - size)
+        return -EAGAIN;
+    idx = rbv->out;
+    if (is_lapped(rbv))
+        end = rbv->in;
+    else
+        end = rbv->in + 1;
+    for (; size && idx < end; idx++) {
+        rbvec_chunk_t *c;
+        unsigned int s;
+
+        c = &rbv->vec[idx & rbv->mask];
+        if (!c->buffer)
+            break;
+        if (offset >= rbvec_chunk_used(c)) {
+            offset -= rbvec_chunk_used(c);
+            continue;
+        }
+        s = min(size, rbvec_chunk_used(c) - offset);
+        rb_peek_raw(c->buffer, c->size, (c->out + offset) & (c->size - 1), d, s);
+        d += s;
+        size -= s;
+        offset = 0;
+    }
+    assert(size == 0);
+
+    return 0;
+}
+
+int rbvec_set_watermark(rbvec_t *rbv, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr)
+{
+    return wm_init(&rbv->wm, low, high, cb, ptr, rbvec_used_size(rbv));
+}
+
+void rbvec_clear_watermark(rbvec_t *rbv)
+{
+    free(rbv->wm);
+    rbv->wm = NULL;
+}
+
 int rbvec_read(rbvec_t *rbv, rb_read_pt read_cb, void *ptr, unsigned int *read)
 {
     struct iovec *vecbuf;
@@ -533,7 +1255,7 @@ int rbvec_read(rbvec_t *rbv, rb_read_pt read_cb, void *ptr, unsigned int *read)
     do {
         vecbuf = NULL;
         vecbuf_cnt = vecbuf_size = 0;
-        rv = rbvec_producer_force_peek(rbv, rbv->ele_size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
+        rv = rbvec_producer_force_peek(rbv, rbv->chunk_size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
         if (rv < 0)
             return rv;
         if (vecbuf_size) {
@@ -545,6 +1267,7 @@ int rbvec_read(rbvec_t *rbv, rb_read_pt read_cb, void *ptr, unsigned int *read)
                 assert(p == (unsigned int)rv);
                 *read += (unsigned int)rv;
             }
+            free(vecbuf);
         }
     } while (rv > 0 && (unsigned int)rv == vecbuf_size);
 
@@ -560,7 +1283,7 @@ int rbvec_write(rbvec_t *rbv, rb_write_pt write_cb, void *ptr, unsigned int *wro
     do {
         vecbuf = NULL;
         vecbuf_cnt = vecbuf_size = 0;
-        rv = rbvec_consumer_peek(rbv, rbv->ele_size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
+        rv = rbvec_consumer_peek(rbv, rbv->chunk_size, &vecbuf, &vecbuf_cnt, &vecbuf_size);
         if (rv < 0)
             return rv;
         if (vecbuf_size) {
@@ -572,8 +1295,186 @@ int rbvec_write(rbvec_t *rbv, rb_write_pt write_cb, void *ptr, unsigned int *wro
                 assert(c == (unsigned int)rv);
                 *wrote += (unsigned int)rv;
             }
+            free(vecbuf);
         }
     } while (rv > 0 && (unsigned int)rv == vecbuf_size);
 
     return rv;
 }
+
+#define txn_iov(txn)    ((txn)->iov ? (txn)->iov : (txn)->vec)
+
+/* every open handle gets its own generation, a nested one is closed with any of its parents */
+static unsigned int txn_gen;
+
+static unsigned int txn_next_gen(void)
+{
+    unsigned int gen;
+
+    while (!(gen = __atomic_add_fetch(&txn_gen, 1, __ATOMIC_RELAXED)))
+        ;
+
+    return gen;
+}
+
+static int txn_closed(const rb_txn_t *txn)
+{
+    for (; txn->parent; txn = txn->parent)
+        if (!txn->gen || txn->parent->gen != txn->parent_gen)
+            return 1;
+
+    return !txn->gen;
+}
+
+/* Exactly max bytes at in, both sides of the wrap; -EAGAIN when they are not free yet */
+int rb_reserve(rb_t *rb, unsigned int max, rb_txn_t *txn)
+{
+    unsigned char *buf = NULL;
+    unsigned int s;
+
+    if (!max || max > rb->size)
+        return -EINVAL;
+    if (rb_avail_size(rb) < max)
+        return -EAGAIN;
+    memset(txn, 0, sizeof(*txn));
+    txn->rb = rb;
+    txn->gen = txn_next_gen();
+    txn->len = max;
+    s = rb_producer_peek(rb, max, &buf);
+    txn->vec[0].iov_base = buf;
+    txn->vec[0].iov_len = s;
+    txn->iov_cnt = 1;
+    if (s < max) {
+        rb_producer_peek_at(rb, s, max - s, &buf);
+        txn->vec[1].iov_base = buf;
+        txn->vec[1].iov_len = max - s;
+        txn->iov_cnt = 2;
+    }
+
+    return 0;
+}
+
+/* Expands like rbvec_putsv, the reservation may span several chunks */
+int rbvec_reserve(rbvec_t *rbv, unsigned int max, rb_txn_t *txn)
+{
+    struct iovec *vecbuf = NULL;
+    unsigned int vecbuf_cnt = 0, vecbuf_size = 0;
+    int rv;
+
+    if (!max || max > rbvec_max_size(rbv))
+        return -EINVAL;
+    if (max > rbvec_max_size(rbv) - rbvec_used_size(rbv))
+        return -EAGAIN;
+    rv = rbvec_producer_force_peek(rbv, max, &vecbuf, &vecbuf_cnt, &vecbuf_size);
+    if (rv < 0)
+        return rv;
+    if (vecbuf_size < max) {
+        free(vecbuf);
+        return -EAGAIN;
+    }
+    memset(txn, 0, sizeof(*txn));
+    txn->rbv = rbv;
+    txn->gen = txn_next_gen();
+    txn->iov = vecbuf;
+    txn->iov_cnt = vecbuf_cnt;
+    txn->len = max;
+
+    return 0;
+}
+
+int rb_reserve_nested(rb_txn_t *parent, unsigned int offset, unsigned int max, rb_txn_t *txn)
+{
+    if (txn_closed(parent) || !max || offset > parent->len || max > parent->len - offset)
+        return -EINVAL;
+    memset(txn, 0, sizeof(*txn));
+    txn->gen = txn_next_gen();
+    txn->parent = parent;
+    txn->parent_gen = parent->gen;
+    txn->iov = txn_iov(parent);
+    txn->iov_cnt = parent->iov_cnt;
+    txn->off = parent->off + offset;
+    txn->len = max;
+
+    return 0;
+}
+
+/* A closed handle belongs to nothing and has no length */
+static void txn_close(rb_txn_t *txn)
+{
+    txn->rb = NULL;
+    txn->rbv = NULL;
+    txn->parent = NULL;
+    txn->iov = NULL;
+    txn->iov_cnt = 0;
+    txn->len = 0;
+    txn->gen = 0;
+}
+
+/* A nested commit only raises the parent's used mark, the top level one publishes */
+int rb_commit(rb_txn_t *txn, unsigned int actual)
+{
+    unsigned int end;
+
+    /* below used would cut off what a nested reservation already committed */
+    if (txn_closed(txn) || actual > txn->len || actual < txn->used)
+        return -EINVAL;
+    if (txn->parent) {
+        end = txn->off - txn->parent->off + actual;
+        if (end > txn->parent->used)
+            txn->parent->used = end;
+    } else if (txn->rb)
+        rb_produced(txn->rb, actual);
+    else {
+        rbvec_produced(txn->rbv, actual);
+        free(txn->iov);
+    }
+    txn_close(txn);
+
+    return 0;
+}
+
+void rb_abort(rb_txn_t *txn)
+{
+    if (!txn->parent && txn->rbv)
+        free(txn->iov);
+    txn_close(txn);
+}
+
+/* Contiguous bytes at offset of the reservation, 0 past its end */
+unsigned int rb_txn_peek(rb_txn_t *txn, unsigned int offset, unsigned char **buf)
+{
+    const struct iovec *iov = txn_iov(txn);
+    unsigned int i, pos;
+
+    if (txn_closed(txn) || offset >= txn->len)
+        return 0;
+    pos = txn->off + offset;
+    for (i = 0; i < txn->iov_cnt; i++) {
+        if (pos < iov[i].iov_len) {
+            *buf = (unsigned char *)iov[i].iov_base + pos;
+            return min((unsigned int)iov[i].iov_len - pos, txn->len - offset);
+        }
+        pos -= iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+int rb_txn_write(rb_txn_t *txn, unsigned int offset, const void *src, unsigned int size)
+{
+    const unsigned char *p = (const unsigned char *)src;
+    unsigned char *buf;
+    unsigned int s;
+
+    if (txn_closed(txn) || offset > txn->len || size > txn->len - offset)
+        return -EINVAL;
+    while (size) {
+        s = min(rb_txn_peek(txn, offset, &buf), size);
+        memcpy(buf, p, s);
+        p += s;
+        offset += s;
+        size -= s;
+    }
+
+    return 0;
+}
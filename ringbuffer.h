@@ -6,28 +6,73 @@
 #ifndef __RINGBUFFER_H__
 #define __RINGBUFFER_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/uio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* high is 1 when usage rises to the high watermark, 0 when it falls back to the low one */
+typedef void(*rb_wm_pt)(void *ptr, int high);
+
+typedef struct rb_wm_t{
+    unsigned int low;
+    unsigned int high;
+    int above;
+    rb_wm_pt cb;
+    void *ptr;
+} rb_wm_t;
+
+typedef struct rb_idle_t{
+    unsigned int low;
+    unsigned int period;        /* ms at or below low before the free pages go */
+    int busy;
+    unsigned long long since;
+} rb_idle_t;
+
 typedef struct rb_t{
     unsigned int size;
     unsigned int in;
     unsigned int out;
     unsigned int mask;
+    int fd;                     /* memfd behind the buffer, -1 if none */
+    unsigned int map_size;      /* length of the mapping, 0 if malloc'd */
+    rb_wm_t *wm;
+    rb_idle_t *idle;
     unsigned char buffer[0];
 } rb_t;
 
 int rb_init(rb_t **rb, unsigned int size);
+int rb_init_memfd(rb_t **rb, unsigned int size);
+int rb_attach(rb_t **rb, int fd);
+int rb_detach(rb_t *rb);
 void rb_reinit(rb_t *rb);
 void rb_deinit(rb_t *rb);
 unsigned int rb_gets(rb_t *rb, unsigned char *buf, unsigned int size);
 int rb_get_all(rb_t *rb, unsigned char **buf, unsigned int *buf_size);
 unsigned int rb_puts(rb_t *rb, const unsigned char *buf, unsigned int size);
+unsigned int rb_getsv(rb_t *rb, const struct iovec *iov, unsigned int iov_cnt);
+unsigned int rb_putsv(rb_t *rb, const struct iovec *iov, unsigned int iov_cnt);
 unsigned int rb_consumer_peek_at(rb_t *rb, unsigned int offset, unsigned int size, unsigned char **buf);
 unsigned int rb_producer_peek_at(rb_t *rb, unsigned int offset, unsigned int size, unsigned char **buf);
 #define rb_consumer_peek(rb, size, buf) rb_consumer_peek_at(rb, 0, size, buf)
 #define rb_producer_peek(rb, size, buf) rb_producer_peek_at(rb, 0, size, buf)
-#define rb_consumed(rb, size)   ((rb)->out += (size))
-#define rb_produced(rb, size)   ((rb)->in += (size))
+#define rb_consumed(rb, size)   ((rb)->out += (size), rb_wm_check(rb))
+#define rb_produced(rb, size)   ((rb)->in += (size), rb_wm_check(rb))
+int rb_set_watermark(rb_t *rb, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr);
+void rb_clear_watermark(rb_t *rb);
+/* Buffers of RB_MMAP_THRESHOLD or more are page aligned, their free pages can be given back */
+#define RB_MMAP_THRESHOLD       (64 << 10)
+unsigned int rb_reclaim(rb_t *rb);
+int rb_set_reclaim(rb_t *rb, unsigned int low, unsigned int idle_ms);
+void rb_clear_reclaim(rb_t *rb);
+unsigned int rb_reclaim_tick(rb_t *rb, unsigned long long now_ms);
+unsigned int rb_resident_size(rb_t *rb);
+#define rb_wm_check(rb)         ((rb)->wm ? rb_wm_update((rb)->wm, rb_used_size(rb)) : (void)0)
 typedef int(*rb_read_pt)(void *, void *, unsigned int);
 typedef int(*rb_write_pt)(void *, const void *, unsigned int);
 int rb_read(rb_t *rb, rb_read_pt read_cb, void *ptr, unsigned int *read);
@@ -37,6 +82,198 @@ int rb_write(rb_t *rb, rb_write_pt write_cb, void *ptr, unsigned int *wrote);
 #define rb_avail_size(rb)       (rb_size(rb) - rb_used_size(rb))
 #define rb_is_empty(rb)         ((rb)->in == (rb)->out)
 #define rb_is_full(rb)          (rb_used_size(rb) > (rb)->mask)
+#define rb_fd(rb)               ((rb)->fd)
+/* one producer thread and one consumer thread sharing a rb_t */
+#define rb_smp_in(rb)               __atomic_load_n(&(rb)->in, __ATOMIC_ACQUIRE)
+#define rb_smp_out(rb)              __atomic_load_n(&(rb)->out, __ATOMIC_ACQUIRE)
+#define rb_smp_produced(rb, size)   __atomic_store_n(&(rb)->in, (rb)->in + (size), __ATOMIC_RELEASE)
+#define rb_smp_consumed(rb, size)   __atomic_store_n(&(rb)->out, (rb)->out + (size), __ATOMIC_RELEASE)
+
+/* rb_producer_peek/rb_consumer_peek for either side of such a pair, up to the wrap */
+static inline unsigned int rb_smp_producer_peek(rb_t *rb, unsigned int size, unsigned char **buf)
+{
+    unsigned int avail = rb->size - (rb->in - rb_smp_out(rb));
+    unsigned int roll = rb->size - (rb->in & rb->mask);
+
+    *buf = rb->buffer + (rb->in & rb->mask);
+    size = size < avail ? size : avail;
+
+    return size < roll ? size : roll;
+}
+
+static inline unsigned int rb_smp_consumer_peek(rb_t *rb, unsigned int size, unsigned char **buf)
+{
+    unsigned int used = rb_smp_in(rb) - rb->out;
+    unsigned int roll = rb->size - (rb->out & rb->mask);
+
+    *buf = rb->buffer + (rb->out & rb->mask);
+    size = size < used ? size : used;
+
+    return size < roll ? size : roll;
+}
+
+/* copies of at least rb_copy_threshold() bytes use non-temporal stores, 0 turns them off */
+#define RB_COPY_THRESHOLD       (1 << 20)
+void *rb_memcpy(void *dst, const void *src, size_t n);
+void rb_set_copy_threshold(size_t threshold);
+size_t rb_copy_threshold(void);
+const char *rb_copy_engine(void);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define rb_be16toh(x)   (x)
+#define rb_be32toh(x)   (x)
+#define rb_be64toh(x)   (x)
+#else
+#define rb_be16toh(x)   __builtin_bswap16(x)
+#define rb_be32toh(x)   __builtin_bswap32(x)
+#define rb_be64toh(x)   __builtin_bswap64(x)
+#endif
+#define RB_VARINT_MAX   10      /* LEB128 bytes of a uint64_t */
+
+/*
+ * Typed readers at a consumer offset, nothing is consumed.
+ * 0 on success, -EAGAIN when the field is not all there yet,
+ * -EINVAL for a varint longer than RB_VARINT_MAX bytes or above UINT64_MAX.
+ */
+static inline void rb_peek_raw(const unsigned char *buffer, unsigned int bsize, unsigned int pos, void *dst, unsigned int size)
+{
+    unsigned int l;
+
+    if (pos + size <= bsize) {
+        memcpy(dst, buffer + pos, size);
+        return;
+    }
+    /* stitched only across the wrap */
+    l = bsize - pos;
+    memcpy(dst, buffer + pos, l);
+    memcpy((unsigned char *)dst + l, buffer, size - l);
+}
+
+static inline int rb_peek(rb_t *rb, unsigned int offset, void *dst, unsigned int size)
+{
+    unsigned int used = rb_used_size(rb);
+
+    if (size > used || offset > used - size)
+        return -EAGAIN;
+    rb_peek_raw(rb->buffer, rb->size, (rb->out + offset) & rb->mask, dst, size);
+
+    return 0;
+}
+
+static inline int rb_peek_be16(rb_t *rb, unsigned int offset, uint16_t *v)
+{
+    uint16_t x;
+
+    if (rb_peek(rb, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be16toh(x);
+
+    return 0;
+}
+
+static inline int rb_peek_be32(rb_t *rb, unsigned int offset, uint32_t *v)
+{
+    uint32_t x;
+
+    if (rb_peek(rb, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be32toh(x);
+
+    return 0;
+}
+
+static inline int rb_peek_be64(rb_t *rb, unsigned int offset, uint64_t *v)
+{
+    uint64_t x;
+
+    if (rb_peek(rb, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be64toh(x);
+
+    return 0;
+}
+
+/* n is how many bytes are there, a varint not ended within them needs more data */
+static inline int rb_varint_decode(const unsigned char *p, unsigned int n, uint64_t *v, unsigned int *len)
+{
+    uint64_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n && i < RB_VARINT_MAX; i++) {
+        x |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            if (i == RB_VARINT_MAX - 1 && p[i] > 1)
+                return -EINVAL;
+            *v = x;
+            *len = i + 1;
+            return 0;
+        }
+    }
+
+    return i == RB_VARINT_MAX ? -EINVAL : -EAGAIN;
+}
+
+/* n is the stored bytes from pos, at most RB_VARINT_MAX */
+static inline int rb_varint_raw(const unsigned char *buffer, unsigned int bsize, unsigned int pos, unsigned int n, uint64_t *v, unsigned int *len)
+{
+    unsigned char tmp[RB_VARINT_MAX];
+
+    if (pos + n <= bsize)
+        return rb_varint_decode(buffer + pos, n, v, len);
+    rb_peek_raw(buffer, bsize, pos, tmp, n);
+
+    return rb_varint_decode(tmp, n, v, len);
+}
+
+/* *len is the encoded length to skip */
+static inline int rb_peek_varint(rb_t *rb, unsigned int offset, uint64_t *v, unsigned int *len)
+{
+    unsigned int used = rb_used_size(rb), n;
+
+    if (offset >= used)
+        return -EAGAIN;
+    n = used - offset;
+    if (n > RB_VARINT_MAX)
+        n = RB_VARINT_MAX;
+
+    return rb_varint_raw(rb->buffer, rb->size, (rb->out + offset) & rb->mask, n, v, len);
+}
+
+#define RBVEC_LAZY      0x01    /* allocate a chunk when the producer first reaches it */
+#define RBVEC_MEMFD     0x02    /* header, chunk table and chunks live in one memfd, see rbvec_attach */
+
+typedef struct rbvec_policy_t{
+    unsigned int flags;
+    unsigned int growth_shift;  /* chunk size << growth_shift on every expansion, 0 keeps ele_size */
+    unsigned int max_ele_size;  /* upper bound of the chunk size, 0 means no bound */
+    unsigned int max_size;      /* upper bound of the total bytes besides max_num, 0 means no bound */
+} rbvec_policy_t;
+
+/* Only a crossing calls back, between the watermarks nothing happens */
+static inline void rb_wm_update(rb_wm_t *wm, unsigned int used)
+{
+    if (!wm->above) {
+        if (used >= wm->high) {
+            wm->above = 1;
+            wm->cb(wm->ptr, 1);
+        }
+    } else if (used <= wm->low) {
+        wm->above = 0;
+        wm->cb(wm->ptr, 0);
+    }
+}
+
+/* Chunk headers sit side by side in rbvec_t, walking them stays in a few cache lines */
+typedef struct rbvec_chunk_t{
+    unsigned int size;          /* 0 until the payload is allocated */
+    unsigned int in;
+    unsigned int out;
+    unsigned int flags;
+    unsigned char *buffer;      /* carved from a slab, or the memfd mapping */
+    unsigned long long off;     /* RBVEC_MEMFD: offset of buffer in the mapping */
+} rbvec_chunk_t;
+
+#define RBVEC_SLAB_MAX  32      /* one slab per expansion */
 
 typedef struct rbvec_t{
     unsigned int max_num;
@@ -45,15 +282,33 @@ typedef struct rbvec_t{
     unsigned int in;
     unsigned int out;
     unsigned int mask;
-    rb_t *vec[0];
+    unsigned int flags;
+    unsigned int growth_shift;
+    unsigned int max_ele_size;
+    unsigned int chunk_size;    /* size of the chunks added by the last expansion */
+    unsigned int size;          /* sum of the chunk sizes, allocated or not */
+    unsigned int max_size;
+    unsigned int used;
+    int fd;
+    unsigned int slab_num;
+    unsigned char *slab[RBVEC_SLAB_MAX];
+    unsigned long long map_size;    /* RBVEC_MEMFD: the header and max_size bytes of payload */
+    unsigned long long map_used;
+    rb_wm_t *wm;
+    rbvec_chunk_t vec[0];
 } rbvec_t;
 
 int rbvec_init(rbvec_t **rbv, unsigned int max_num, unsigned int ele_size);
+int rbvec_init_policy(rbvec_t **rbv, unsigned int max_num, unsigned int ele_size, const rbvec_policy_t *policy);
+int rbvec_attach(rbvec_t **rbv, int fd);
+int rbvec_detach(rbvec_t *rbv);
 void rbvec_reinit(rbvec_t *rbv);
 void rbvec_deinit(rbvec_t *rbv);
 unsigned int rbvec_gets(rbvec_t *rbv, unsigned char *buf, unsigned int size);
 int rbvec_get_all(rbvec_t *rbv, unsigned char **buf, unsigned int *buf_size);
 unsigned int rbvec_puts(rbvec_t *rbv, const unsigned char *buf, unsigned int size);
+unsigned int rbvec_getsv(rbvec_t *rbv, const struct iovec *iov, unsigned int iov_cnt);
+unsigned int rbvec_putsv(rbvec_t *rbv, const struct iovec *iov, unsigned int iov_cnt);
 int rbvec_consumer_peek_at(rbvec_t *rbv, 
     unsigned int offset, 
     unsigned int size, 
@@ -82,21 +337,129 @@ unsigned int rbvec_consumed(rbvec_t *rbv, unsigned int size);
 unsigned int rbvec_produced(rbvec_t *rbv, unsigned int size);
 int rbvec_read(rbvec_t *rbv, rb_read_pt read_cb, void *ptr, unsigned int *read);
 int rbvec_write(rbvec_t *rbv, rb_write_pt write_cb, void *ptr, unsigned int *wrote);
+int rbvec_set_watermark(rbvec_t *rbv, unsigned int low, unsigned int high, rb_wm_pt cb, void *ptr);
+void rbvec_clear_watermark(rbvec_t *rbv);
+#define rbvec_wm_check(rbv)     ((rbv)->wm ? rb_wm_update((rbv)->wm, rbvec_used_size(rbv)) : (void)0)
+#define rbvec_fd(rbv)           ((rbv)->fd)
 #define rbvec_max_num(rbv)      ((rbv)->max_num)
 #define rbvec_num(rbv)          (1 << (rbv)->cnt_bit_offset)
 #define rbvec_used_num(rbv)     ((rbv)->in - (rbv)->out)
 #define rbvec_avail_num(rbv)    (rbvec_num(rbv) - rbvec_used_num(rbv))
-#define rbvec_max_size(rbv)     ((rbv)->ele_size * rbvec_max_num(rbv))
-#define rbvec_size(rbv)         ((rbv)->ele_size * rbvec_num(rbv))
-#define rbvec_used_size(rbv)                    \
-    (rbvec_is_empty(rbv) ? 0 :                  \
-    (rbvec_is_full(rbv) ? rbvec_max_size(rbv) : \
-    ((rbv)->ele_size * rbvec_used_num(rbv) - rb_avail_size((rbv)->vec[(rbv)->out & (rbv)->mask]) + rb_used_size((rbv)->vec[(rbv)->in & (rbv)->mask]))   \
-    ))
+#define rbvec_max_size(rbv)     ((rbv)->max_size)
+#define rbvec_size(rbv)         ((rbv)->size)
+#define rbvec_used_size(rbv)    ((rbv)->used)
 #define rbvec_avail_size(rbv)   (rbvec_size(rbv) - rbvec_used_size(rbv))
-#define rbvec_is_empty(rbv)     ((rbv)->in == (rbv)->out && rb_is_empty((rbv)->vec[(rbv)->in & (rbv)->mask]))
-#define rbvec_is_full(rbv)      ((rbvec_used_num(rbv) == rbvec_max_num(rbv))                \
-                                && rb_is_full((rbv)->vec[((rbv)->out - 1) & (rbv)->mask])   \
-                                && rb_is_full((rbv)->vec[(rbv)->in & (rbv)->mask]))
+#define rbvec_is_empty(rbv)     (rbvec_used_size(rbv) == 0)
+#define rbvec_is_full(rbv)      (rbvec_used_size(rbv) == rbvec_max_size(rbv))
+#define rbvec_chunk_used(c)     ((c)->in - (c)->out)
+#define rbvec_chunk_avail(c)    ((c)->size - rbvec_chunk_used(c))
+
+/* Same as the rb_peek family, rbvec_peek_copy walks the chunks when a field spans two */
+int rbvec_peek_copy(rbvec_t *rbv, unsigned int offset, void *dst, unsigned int size);
+
+static inline int rbvec_peek(rbvec_t *rbv, unsigned int offset, void *dst, unsigned int size)
+{
+    rbvec_chunk_t *c;
+
+    if (size > rbv->used || offset > rbv->used - size)
+        return -EAGAIN;
+    if (!size)
+        return 0;
+    c = &rbv->vec[rbv->out & rbv->mask];
+    if (offset + size <= rbvec_chunk_used(c)) {
+        rb_peek_raw(c->buffer, c->size, (c->out + offset) & (c->size - 1), dst, size);
+        return 0;
+    }
+
+    return rbvec_peek_copy(rbv, offset, dst, size);
+}
+
+static inline int rbvec_peek_be16(rbvec_t *rbv, unsigned int offset, uint16_t *v)
+{
+    uint16_t x;
+
+    if (rbvec_peek(rbv, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be16toh(x);
+
+    return 0;
+}
+
+static inline int rbvec_peek_be32(rbvec_t *rbv, unsigned int offset, uint32_t *v)
+{
+    uint32_t x;
+
+    if (rbvec_peek(rbv, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be32toh(x);
+
+    return 0;
+}
+
+static inline int rbvec_peek_be64(rbvec_t *rbv, unsigned int offset, uint64_t *v)
+{
+    uint64_t x;
+
+    if (rbvec_peek(rbv, offset, &x, sizeof(x)) < 0)
+        return -EAGAIN;
+    *v = rb_be64toh(x);
+
+    return 0;
+}
+
+static inline int rbvec_peek_varint(rbvec_t *rbv, unsigned int offset, uint64_t *v, unsigned int *len)
+{
+    unsigned char tmp[RB_VARINT_MAX];
+    unsigned int n;
+    rbvec_chunk_t *c;
+
+    if (offset >= rbv->used)
+        return -EAGAIN;
+    n = rbv->used - offset;
+    if (n > RB_VARINT_MAX)
+        n = RB_VARINT_MAX;
+    c = &rbv->vec[rbv->out & rbv->mask];
+    if (offset + n <= rbvec_chunk_used(c))
+        return rb_varint_raw(c->buffer, c->size, (c->out + offset) & (c->size - 1), n, v, len);
+    rbvec_peek_copy(rbv, offset, tmp, n);
+
+    return rb_varint_decode(tmp, n, v, len);
+}
+
+/*
+ * Reserve space, encode straight into it, then commit what was written or
+ * abort. A nested reservation is a window of its parent, committing it only
+ * moves the parent's used mark, so a length prefix can be patched in after
+ * the body is encoded. Committing or aborting a reservation closes it and
+ * every one nested in it. One top level reservation at a time per buffer,
+ * and the handle must not be copied while it is open.
+ */
+typedef struct rb_txn_t{
+    rb_t *rb;                   /* owner of a top level reservation */
+    rbvec_t *rbv;
+    struct rb_txn_t *parent;    /* set for a nested one */
+    struct iovec *iov;          /* the top level reservation, NULL for a rb_t one that uses vec */
+    unsigned int iov_cnt;
+    unsigned int off;           /* window into iov */
+    unsigned int len;
+    unsigned int used;          /* high mark of what nested reservations committed */
+    unsigned int gen;           /* 0 once committed or aborted */
+    unsigned int parent_gen;    /* the parent's gen when this one was reserved */
+    struct iovec vec[2];
+} rb_txn_t;
+
+int rb_reserve(rb_t *rb, unsigned int max, rb_txn_t *txn);
+int rbvec_reserve(rbvec_t *rbv, unsigned int max, rb_txn_t *txn);
+int rb_reserve_nested(rb_txn_t *parent, unsigned int offset, unsigned int max, rb_txn_t *txn);
+int rb_commit(rb_txn_t *txn, unsigned int actual);
+void rb_abort(rb_txn_t *txn);
+unsigned int rb_txn_peek(rb_txn_t *txn, unsigned int offset, unsigned char **buf);
+int rb_txn_write(rb_txn_t *txn, unsigned int offset, const void *src, unsigned int size);
+#define rb_txn_len(txn)         ((txn)->len)
+#define rb_txn_used(txn)        ((txn)->used)
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* __RINGBUFFER_H__ */
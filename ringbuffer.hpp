@@ -0,0 +1,240 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* header only C++20 version of rb_t, capacity fixed at compile time */
+
+#ifndef __RINGBUFFER_HPP__
+#define __RINGBUFFER_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace rb {
+
+/* the two regions of a peek, second is empty unless the range wraps */
+template <typename T>
+struct regions {
+    std::span<T> first;
+    std::span<T> second;
+
+    constexpr std::size_t size() const noexcept { return first.size() + second.size(); }
+    constexpr bool empty() const noexcept { return first.empty(); }
+};
+
+template <typename T, std::size_t N>
+class ringbuffer {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+    static_assert(N <= 0x80000000u, "N must fit the unsigned int indexes");
+
+public:
+    using value_type = T;
+    using size_type = unsigned int;
+
+    static constexpr size_type capacity = static_cast<size_type>(N);
+    static constexpr size_type mask = capacity - 1;
+
+    ringbuffer() noexcept = default;
+    ringbuffer(const ringbuffer &) = delete;
+    ringbuffer &operator=(const ringbuffer &) = delete;
+    ~ringbuffer() { clear(); }
+
+    static constexpr size_type size() noexcept { return capacity; }
+    size_type used_size() const noexcept { return in_ - out_; }
+    size_type avail_size() const noexcept { return capacity - used_size(); }
+    bool empty() const noexcept { return in_ == out_; }
+    bool full() const noexcept { return used_size() > mask; }
+
+    void clear() noexcept
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            while (!empty())
+                std::destroy_at(slot(out_++));
+        in_ = out_ = 0;
+    }
+
+    template <typename... Args>
+    bool emplace(Args &&...args) noexcept(std::is_nothrow_constructible_v<T, Args...>)
+    {
+        if (full())
+            return false;
+        std::construct_at(slot(in_), std::forward<Args>(args)...);
+        ++in_;
+        return true;
+    }
+
+    bool push(T &&v) noexcept(std::is_nothrow_move_constructible_v<T>) { return emplace(std::move(v)); }
+
+    /* moves the oldest element out and destroys the slot */
+    bool pop(T &v) noexcept(std::is_nothrow_move_assignable_v<T>)
+    {
+        if (empty())
+            return false;
+        T *p = slot(out_);
+        v = std::move(*p);
+        std::destroy_at(p);
+        ++out_;
+        return true;
+    }
+
+    T &front() noexcept { return *slot(out_); }
+
+    /* Not Zerocopy */
+    size_type puts(const T *buf, size_type n)
+    {
+        n = std::min(n, avail_size());
+        size_type s = std::min(n, capacity - (in_ & mask));
+        std::uninitialized_copy_n(buf, s, slot(in_));
+        /* a throw in the second range would leak the first one */
+        try {
+            std::uninitialized_copy_n(buf + s, n - s, slot(0));
+        } catch (...) {
+            std::destroy_n(slot(in_), s);
+            throw;
+        }
+        in_ += n;
+        return n;
+    }
+
+    /* Not Zerocopy */
+    size_type gets(T *buf, size_type n)
+    {
+        n = std::min(n, used_size());
+        move_out(buf, n);
+        return n;
+    }
+
+    regions<T> consumer_peek_at(size_type offset, size_type n) noexcept
+    {
+        if (offset >= used_size())
+            return {};
+        return split(out_ + offset, std::min(n, used_size() - offset));
+    }
+
+    regions<T> consumer_peek(size_type n) noexcept { return consumer_peek_at(0, n); }
+
+    /* destroys the elements, like rb_consumed */
+    void consumed(size_type n) noexcept
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            for (size_type i = 0; i < n; i++)
+                std::destroy_at(slot(out_ + i));
+        out_ += n;
+    }
+
+    /* free space is raw storage, only types without constructors may be written through it */
+    regions<T> producer_peek_at(size_type offset, size_type n) noexcept
+        requires std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>
+    {
+        if (offset >= avail_size())
+            return {};
+        return split(in_ + offset, std::min(n, avail_size() - offset));
+    }
+
+    regions<T> producer_peek(size_type n) noexcept
+        requires std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>
+    {
+        return producer_peek_at(0, n);
+    }
+
+    void produced(size_type n) noexcept
+        requires std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>
+    {
+        in_ += n;
+    }
+
+    /* rb_read/rb_write with the callback inlined, cb(T *, size_type) returns like rb_read_pt */
+    template <typename F>
+    int read(F &&cb, size_type &read)
+        requires std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>
+    {
+        int rv;
+        size_type n;
+
+        do {
+            rv = 0;
+            n = static_cast<size_type>(producer_peek(capacity).first.size());
+            if (n) {
+                rv = cb(slot(in_), n);
+                if (rv > 0) {
+                    in_ += static_cast<size_type>(rv);
+                    read += static_cast<size_type>(rv);
+                }
+            }
+        } while (rv > 0 && static_cast<size_type>(rv) == n);
+
+        return rv;
+    }
+
+    template <typename F>
+    int write(F &&cb, size_type &wrote)
+        requires std::is_trivially_copyable_v<T>
+    {
+        int rv;
+        size_type n;
+
+        do {
+            rv = 0;
+            n = static_cast<size_type>(consumer_peek(capacity).first.size());
+            if (n) {
+                rv = cb(static_cast<const T *>(slot(out_)), n);
+                if (rv > 0) {
+                    out_ += static_cast<size_type>(rv);
+                    wrote += static_cast<size_type>(rv);
+                }
+            }
+        } while (rv > 0 && static_cast<size_type>(rv) == n);
+
+        return rv;
+    }
+
+private:
+    T *slot(size_type idx) noexcept
+    {
+        return std::launder(reinterpret_cast<T *>(storage_) + (idx & mask));
+    }
+
+    regions<T> split(size_type from, size_type n) noexcept
+    {
+        size_type s = std::min(n, capacity - (from & mask));
+        return { std::span<T>(slot(from), s), std::span<T>(slot(0), n - s) };
+    }
+
+    /* out_ moves past each element as it is destroyed, a throwing move leaves only live ones behind */
+    void move_out(T *dst, size_type n)
+    {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            size_type s = std::min(n, capacity - (out_ & mask));
+            if (s)
+                std::memcpy(static_cast<void *>(dst), slot(out_), sizeof(T) * s);
+            if (n - s)
+                std::memcpy(static_cast<void *>(dst + s), slot(0), sizeof(T) * (n - s));
+            out_ += n;
+        } else {
+            for (size_type i = 0; i < n; i++) {
+                T *p = slot(out_);
+                dst[i] = std::move(*p);
+                std::destroy_at(p);
+                ++out_;
+            }
+        }
+    }
+
+    size_type in_ = 0;
+    size_type out_ = 0;
+    alignas(alignof(T) > 64 ? alignof(T) : 64) unsigned char storage_[sizeof(T) * N];
+};
+
+template <std::size_t N>
+using byte_ring = ringbuffer<unsigned char, N>;
+
+} /* namespace rb */
+
+#endif /* __RINGBUFFER_HPP__ */
@@ -0,0 +1,146 @@
+/*
+ * wangrenjun <wangrj1981@gmail.com>
+ * No license
+ */
+
+/* co_await on a rb_t, waiters are resumed when the other side commits bytes */
+
+#ifndef __RINGBUFFER_CO_HPP__
+#define __RINGBUFFER_CO_HPP__
+
+#include "ringbuffer.h"
+#include <algorithm>
+#include <coroutine>
+
+namespace rb {
+
+/* resumes on the committing thread, no hop */
+struct inline_executor {
+    void post(std::coroutine_handle<> h) const { h.resume(); }
+};
+
+template <typename Executor = inline_executor>
+class async_ring {
+    /* lives in the awaiting coroutine frame, nothing is allocated per await */
+    struct waiter {
+        unsigned int n;
+        std::coroutine_handle<> h;
+        waiter *next;
+    };
+
+    struct queue {
+        waiter *head = nullptr;
+        waiter *tail = nullptr;
+
+        void push(waiter *w) noexcept
+        {
+            w->next = nullptr;
+            if (tail)
+                tail->next = w;
+            else
+                head = w;
+            tail = w;
+        }
+
+        waiter *pop() noexcept
+        {
+            waiter *w = head;
+            head = w->next;
+            if (!head)
+                tail = nullptr;
+            return w;
+        }
+    };
+
+public:
+    class readable_awaiter : waiter {
+    public:
+        readable_awaiter(async_ring &r, unsigned int n) noexcept : r_(r) { this->n = n; }
+        bool await_ready() const noexcept { return !r_.readers_.head && rb_used_size(r_.rb_) >= this->n; }
+        void await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            this->h = h;
+            r_.readers_.push(this);
+        }
+        void await_resume() const noexcept {}
+
+    private:
+        async_ring &r_;
+    };
+
+    class writable_awaiter : waiter {
+    public:
+        writable_awaiter(async_ring &r, unsigned int n) noexcept : r_(r) { this->n = n; }
+        bool await_ready() const noexcept { return !r_.writers_.head && rb_avail_size(r_.rb_) >= this->n; }
+        void await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            this->h = h;
+            r_.writers_.push(this);
+        }
+        void await_resume() const noexcept {}
+
+    private:
+        async_ring &r_;
+    };
+
+    explicit async_ring(rb_t *rb, Executor ex = Executor()) noexcept : rb_(rb), ex_(ex) {}
+    async_ring(const async_ring &) = delete;
+    async_ring &operator=(const async_ring &) = delete;
+
+    rb_t *get() const noexcept { return rb_; }
+
+    /* n is clamped to rb_size, a larger request could never be satisfied */
+    readable_awaiter readable(unsigned int n) noexcept { return readable_awaiter(*this, std::min(n, rb_size(rb_))); }
+    writable_awaiter writable(unsigned int n) noexcept { return writable_awaiter(*this, std::min(n, rb_size(rb_))); }
+
+    void produced(unsigned int size)
+    {
+        rb_produced(rb_, size);
+        wake_readers();
+    }
+
+    void consumed(unsigned int size)
+    {
+        rb_consumed(rb_, size);
+        wake_writers();
+    }
+
+    unsigned int puts(const unsigned char *buf, unsigned int size)
+    {
+        size = rb_puts(rb_, buf, size);
+        if (size)
+            wake_readers();
+        return size;
+    }
+
+    unsigned int gets(unsigned char *buf, unsigned int size)
+    {
+        size = rb_gets(rb_, buf, size);
+        if (size)
+            wake_writers();
+        return size;
+    }
+
+private:
+    /* FIFO, a large request at the head is not overtaken by smaller ones */
+    void wake_readers()
+    {
+        while (readers_.head && rb_used_size(rb_) >= readers_.head->n)
+            ex_.post(readers_.pop()->h);
+    }
+
+    void wake_writers()
+    {
+        while (writers_.head && rb_avail_size(rb_) >= writers_.head->n)
+            ex_.post(writers_.pop()->h);
+    }
+
+    rb_t *rb_;
+    Executor ex_;
+    queue readers_;
+    queue writers_;
+};
+
+} /* namespace rb */
+
+#endif /* __RINGBUFFER_CO_HPP__ */
@@ -1,16 +1,55 @@
 #include "ringbuffer.h"
+#include "rbshard.h"
+#include "rbreactor.h"
+#include "rbhandoff.h"
+#include "rbev.h"
+#include "rbmp.h"
+#include "rblane.h"
 #include "assert.h"
 #include "string.h"
 #include "stdio.h"
 #include "stdlib.h"
+#include "errno.h"
+#include "limits.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/socket.h"
+#include "sys/epoll.h"
+#include "sched.h"
 
 static void test_rb();
 static void test_rbvec();
+static void test_rbvec_policy();
+static void test_iov();
+static void test_copy();
+static void test_watermark();
+static void test_peek();
+static void test_txn();
+static void test_reclaim();
+static void test_handoff();
+static void test_rbshard();
+static void test_rbreactor();
+static void test_rbev();
+static void test_rbmp();
+static void test_rblane();
 
 int main()
 {
     test_rb();
     test_rbvec();
+    test_rbvec_policy();
+    test_iov();
+    test_copy();
+    test_watermark();
+    test_peek();
+    test_txn();
+    test_reclaim();
+    test_handoff();
+    test_rbshard();
+    test_rbreactor();
+    test_rbev();
+    test_rbmp();
+    test_rblane();
 
     return 0;
 }
@@ -362,6 +401,744 @@ static void test_rbvec()
     printf("rbvec done\n");
 }
 
+static void test_rbvec_policy()
+{
+    rbvec_t *rbv;
+    rbvec_policy_t policy;
+    int rv;
+    unsigned int rs;
+    unsigned char buf1[BUF_SIZE], buf2[BUF_SIZE * 4];
+
+    /* 64, then 128, then 256 byte chunks, 2048 bytes at most */
+    memset(&policy, 0, sizeof(policy));
+    policy.flags = RBVEC_LAZY;
+    policy.growth_shift = 1;
+    policy.max_ele_size = 256;
+    policy.max_size = 2048;
+    rv = rbvec_init_policy(&rbv, 16, 64, &policy);
+    assert(!rv);
+    assert(rbvec_max_size(rbv) == 64 + 128 + 2 * 256 + 4 * 256);
+    assert(rbvec_size(rbv) == 64);
+
+    memset(buf2, 'L', sizeof(buf2));
+    rs = rbvec_puts(rbv, buf2, 64 + 128 + 1);
+    assert(rs == 64 + 128 + 1);
+    assert(rbvec_num(rbv) == 4 && rbvec_size(rbv) == 64 + 128 + 2 * 256);
+    assert(rbv->vec[2].buffer && !rbv->vec[3].buffer);
+    rs = rbvec_gets(rbv, buf2, sizeof(buf2));
+    assert(rs == 64 + 128 + 1 && rbvec_is_empty(rbv));
+    rbvec_deinit(rbv);
+
+    /* eager: one slab per expansion, the chunk headers are inline */
+    policy.flags = 0;
+    rv = rbvec_init_policy(&rbv, 16, 64, &policy);
+    assert(!rv);
+    rs = rbvec_puts(rbv, buf2, 64 + 128 + 1);
+    assert(rs == 64 + 128 + 1 && rbv->slab_num == 3);
+    assert(rbv->vec[3].buffer == rbv->vec[2].buffer + 256 && rbv->vec[3].size == 256);
+    rs = rbvec_gets(rbv, buf2, sizeof(buf2));
+    assert(rs == 64 + 128 + 1);
+    rbvec_deinit(rbv);
+
+    /* expanding while out is in the middle keeps the chunks in order */
+    rv = rbvec_init(&rbv, 8, 64);
+    assert(!rv);
+    memset(buf1, 'A', 64);
+    memset(buf1 + 64, 'B', 64);
+    rs = rbvec_puts(rbv, buf1, BUF_SIZE);
+    assert(rs == BUF_SIZE && rbvec_num(rbv) == 2 && rbvec_used_num(rbv) == 2);
+    rs = rbvec_gets(rbv, buf2, 64);
+    assert(rs == 64 && buf2[0] == 'A' && rbv->out == 1);
+    memset(buf1, 'C', 64);
+    rs = rbvec_puts(rbv, buf1, 64);
+    assert(rs == 64 && rbvec_num(rbv) == 2);
+    memset(buf1, 'D', 10);
+    rs = rbvec_puts(rbv, buf1, 10);
+    assert(rs == 10 && rbvec_num(rbv) == 4 && rbvec_used_size(rbv) == 64 + 64 + 10);
+    rs = rbvec_gets(rbv, buf2, sizeof(buf2));
+    assert(rs == 64 + 64 + 10);
+    assert(buf2[0] == 'B' && buf2[63] == 'B' && buf2[64] == 'C' && buf2[127] == 'C' && buf2[128] == 'D');
+    rbvec_deinit(rbv);
+
+    printf("rbvec policy done\n");
+}
+
+static void test_iov()
+{
+    rb_t *rb;
+    rbvec_t *rbv;
+    int rv;
+    unsigned int rs;
+    unsigned char hdr[8], body[RB_SIZE], trailer[4], out[RB_SIZE + 12];
+    struct iovec iov[3], oiov[2];
+
+    memset(hdr, 'H', sizeof(hdr));
+    memset(body, 'B', sizeof(body));
+    memset(trailer, 'T', sizeof(trailer));
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = body;
+    iov[1].iov_len = BUF_SIZE;
+    iov[2].iov_base = trailer;
+    iov[2].iov_len = sizeof(trailer);
+
+    rv = rb_init(&rb, RB_SIZE);
+    assert(!rv);
+    rb->in = rb->out = RB_SIZE - 4;     /* header wraps */
+    rs = rb_putsv(rb, iov, 3);
+    assert(rs == BUF_SIZE + 12 && rb_used_size(rb) == BUF_SIZE + 12);
+    rs = rb_gets(rb, out, 10);
+    assert(rs == 10 && memcmp(out, "HHHHHHHHBB", 10) == 0);
+
+    /* all or nothing */
+    iov[1].iov_len = RB_SIZE;
+    rs = rb_putsv(rb, iov, 3);
+    assert(rs == 0 && rb_used_size(rb) == BUF_SIZE + 2);
+
+    oiov[0].iov_base = out;
+    oiov[0].iov_len = BUF_SIZE;
+    oiov[1].iov_base = out + BUF_SIZE;
+    oiov[1].iov_len = 4;
+    rs = rb_getsv(rb, oiov, 2);
+    assert(rs == 0);
+    oiov[1].iov_len = 2;
+    rs = rb_getsv(rb, oiov, 2);
+    assert(rs == BUF_SIZE + 2 && rb_is_empty(rb));
+    assert(out[BUF_SIZE - 3] == 'B' && out[BUF_SIZE - 2] == 'T' && out[BUF_SIZE + 1] == 'T');
+
+    /* lengths whose sum wraps an unsigned int */
+    oiov[0].iov_len = 8;
+    oiov[1].iov_len = (size_t)UINT_MAX - 3;
+    rs = rb_putsv(rb, oiov, 2);
+    assert(rs == 0 && rb_is_empty(rb));
+    rs = rb_getsv(rb, oiov, 2);
+    assert(rs == 0);
+    rb_deinit(rb);
+
+    rv = rbvec_init(&rbv, 4, BUF_SIZE);
+    assert(!rv);
+    rs = rbvec_putsv(rbv, iov, 3);
+    assert(rs == 0 && rbvec_is_empty(rbv));
+    iov[1].iov_len = BUF_SIZE * 2;
+    rs = rbvec_putsv(rbv, iov, 3);
+    assert(rs == BUF_SIZE * 2 + 12 && rbvec_used_size(rbv) == rs);
+    oiov[0].iov_len = sizeof(hdr) + BUF_SIZE * 2;
+    oiov[1].iov_base = out + oiov[0].iov_len;
+    oiov[1].iov_len = sizeof(trailer);
+    rs = rbvec_getsv(rbv, oiov, 2);
+    assert(rs == BUF_SIZE * 2 + 12 && rbvec_is_empty(rbv));
+    assert(out[0] == 'H' && out[sizeof(hdr)] == 'B' && memcmp(out + BUF_SIZE * 2 + 8, trailer, 4) == 0);
+    rbvec_deinit(rbv);
+
+    printf("iov done\n");
+}
+
+/* a low threshold sends short and odd aligned copies down the non-temporal path */
+static void test_copy()
+{
+    static const unsigned int sizes[] = { 1, 5, 15, 16, 17, 31, 32, 33, 63, 64, 65, 79, 80, 127, 128, 129,
+        191, 192, 255, 256, 257, 319, 320, 511, 512, 513, 1000 };
+    unsigned char src[1100], dst[1100];
+    unsigned int i, n, doff, soff;
+    size_t threshold;
+
+    threshold = rb_copy_threshold();
+    rb_set_copy_threshold(1);
+    for (i = 0; i < sizeof(src); i++)
+        src[i] = (unsigned char)(i * 7 + 3);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        n = sizes[i];
+        for (doff = 0; doff < 64; doff += (doff < 4 ? 1 : 13)) {
+            for (soff = 0; soff < 8; soff += 3) {
+                memset(dst, 0, sizeof(dst));
+                assert(rb_memcpy(dst + doff, src + soff, n) == dst + doff);
+                assert(memcmp(dst + doff, src + soff, n) == 0);
+                assert(dst[doff + n] == 0 && (doff == 0 || dst[doff - 1] == 0));
+            }
+        }
+    }
+    rb_set_copy_threshold(threshold);
+    assert(rb_copy_threshold() == threshold);
+
+    printf("copy done\n");
+}
+
+static void on_watermark(void *ptr, int high)
+{
+    int *crossings = (int *)ptr;
+
+    crossings[high]++;
+}
+
+static void test_watermark()
+{
+    rb_t *rb;
+    rbvec_t *rbv;
+    int rv, crossings[2] = { 0, 0 };
+    unsigned int rs;
+    unsigned char buf1[RB_SIZE];
+    unsigned char *bufp;
+
+    memset(buf1, 'W', RB_SIZE);
+    rv = rb_init(&rb, RB_SIZE);
+    assert(!rv);
+    rv = rb_set_watermark(rb, 256, 128, on_watermark, crossings);
+    assert(rv == -EINVAL);
+    rv = rb_set_watermark(rb, 64, 256, on_watermark, crossings);
+    assert(!rv);
+
+    rs = rb_puts(rb, buf1, 200);
+    assert(rs == 200 && crossings[1] == 0);
+    rs = rb_producer_peek(rb, 100, &bufp);
+    rb_produced(rb, rs);
+    assert(crossings[1] == 1);
+    rs = rb_puts(rb, buf1, 10);
+    assert(crossings[1] == 1);
+    rs = rb_gets(rb, buf1, 200);
+    assert(rs == 200 && crossings[0] == 0);
+    rs = rb_consumer_peek(rb, 100, &bufp);
+    rb_consumed(rb, 50);
+    assert(rb_used_size(rb) == 60 && crossings[0] == 1);
+    rb_reinit(rb);
+    assert(crossings[0] == 1 && crossings[1] == 1);
+    rb_deinit(rb);
+
+    rv = rbvec_init(&rbv, 8, 64);
+    assert(!rv);
+    rv = rbvec_set_watermark(rbv, 100, 300, on_watermark, crossings);
+    assert(!rv);
+    rs = rbvec_puts(rbv, buf1, 300);
+    assert(rs == 300 && crossings[1] == 2);
+    rs = rbvec_gets(rbv, buf1, 150);
+    assert(crossings[0] == 1);
+    rs = rbvec_consumed(rbv, 60);
+    assert(rs == 60 && crossings[0] == 2);
+    rbvec_clear_watermark(rbv);
+    rbvec_reinit(rbv);
+    assert(crossings[0] == 2 && crossings[1] == 2);
+    rbvec_deinit(rbv);
+
+    printf("watermark done\n");
+}
+
+static void test_peek()
+{
+    rb_t *rb;
+    rbvec_t *rbv;
+    int rv;
+    unsigned int rs, len;
+    unsigned char buf1[RB_SIZE];
+    unsigned char be[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    unsigned char varint[] = { 0xac, 0x02 };
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    memset(buf1, 'P', RB_SIZE);
+    rv = rb_init(&rb, RB_SIZE);
+    assert(!rv);
+    rs = rb_puts(rb, buf1, RB_SIZE - 2);
+    rs = rb_gets(rb, buf1, RB_SIZE - 2);
+
+    /* across the wrap */
+    rs = rb_puts(rb, be, 4);
+    assert(rs == 4 && (rb->in & rb->mask) < (rb->out & rb->mask));
+    rv = rb_peek_be32(rb, 0, &v32);
+    assert(!rv && v32 == 0x01020304);
+    rv = rb_peek_be64(rb, 0, &v64);
+    assert(rv == -EAGAIN && rb_used_size(rb) == 4);
+    rs = rb_puts(rb, be + 4, 4);
+    rv = rb_peek_be64(rb, 0, &v64);
+    assert(!rv && v64 == 0x0102030405060708ULL);
+    rv = rb_peek_be16(rb, 2, &v16);
+    assert(!rv && v16 == 0x0304);
+    rv = rb_peek_be32(rb, 5, &v32);
+    assert(rv == -EAGAIN && rb_used_size(rb) == 8);
+
+    rs = rb_puts(rb, varint, 1);
+    rv = rb_peek_varint(rb, 8, &v64, &len);
+    assert(rv == -EAGAIN);
+    rs = rb_puts(rb, varint + 1, 1);
+    rv = rb_peek_varint(rb, 8, &v64, &len);
+    assert(!rv && v64 == 300 && len == 2);
+    rv = rb_peek_varint(rb, 0, &v64, &len);
+    assert(!rv && v64 == 1 && len == 1);
+    rb_reinit(rb);
+    memset(buf1, 0xff, RB_VARINT_MAX);
+    rs = rb_puts(rb, buf1, RB_VARINT_MAX);
+    rv = rb_peek_varint(rb, 0, &v64, &len);
+    assert(rv == -EINVAL);
+    rb_reinit(rb);
+    buf1[RB_VARINT_MAX - 1] = 0x01;
+    rs = rb_puts(rb, buf1, RB_VARINT_MAX);
+    rv = rb_peek_varint(rb, 0, &v64, &len);
+    assert(!rv && v64 == UINT64_MAX && len == RB_VARINT_MAX);
+    rb_deinit(rb);
+
+    /* across a chunk boundary */
+    rv = rbvec_init(&rbv, 8, 64);
+    assert(!rv);
+    memset(buf1, 'P', RB_SIZE);
+    rs = rbvec_puts(rbv, buf1, 62);
+    rs = rbvec_puts(rbv, be, 8);
+    assert(rs == 8);
+    rv = rbvec_peek_be64(rbv, 62, &v64);
+    assert(!rv && v64 == 0x0102030405060708ULL);
+    rv = rbvec_peek_be32(rbv, 60, &v32);
+    assert(!rv && v32 == 0x50500102);
+    rv = rbvec_peek_be16(rbv, 66, &v16);
+    assert(!rv && v16 == 0x0506);
+    rv = rbvec_peek_be32(rbv, 67, &v32);
+    assert(rv == -EAGAIN && rbvec_used_size(rbv) == 70);
+    rs = rbvec_gets(rbv, buf1, 60);
+    rs = rbvec_puts(rbv, buf1, 57);
+    rs = rbvec_puts(rbv, varint, 1);
+    rv = rbvec_peek_varint(rbv, 67, &v64, &len);
+    assert(rv == -EAGAIN);
+    rs = rbvec_puts(rbv, varint + 1, 1);
+    rv = rbvec_peek_varint(rbv, 67, &v64, &len);
+    assert(!rv && v64 == 300 && len == 2 && rbvec_used_size(rbv) == 69);
+    rbvec_deinit(rbv);
+
+    printf("peek done\n");
+}
+
+static void test_txn()
+{
+    rb_t *rb;
+    rbvec_t *rbv;
+    rb_txn_t msg, body, hdr;
+    unsigned char buf1[RB_SIZE], *p;
+    uint32_t v;
+    unsigned int i;
+    int rv;
+
+    rv = rb_init(&rb, RB_SIZE);
+    assert(!rv);
+    rb->in = rb->out = RB_SIZE - 2;     /* the length prefix wraps */
+    rv = rb_reserve(rb, RB_SIZE + 1, &msg);
+    assert(rv == -EINVAL);
+    rv = rb_reserve(rb, 64, &msg);
+    assert(!rv && msg.iov_cnt == 2 && rb_txn_peek(&msg, 0, &p) == 2);
+    rv = rb_reserve_nested(&msg, 4, 61, &body);
+    assert(rv == -EINVAL);
+    rv = rb_reserve_nested(&msg, 4, 60, &body);
+    assert(!rv && rb_txn_peek(&body, 0, &p) == 60);
+    rv = rb_txn_write(&body, 0, "0123456789", 10);
+    assert(!rv);
+    rv = rb_commit(&body, 61);
+    assert(rv == -EINVAL);
+    rb_commit(&body, 10);
+    assert(rb_txn_used(&msg) == 14 && rb_is_empty(rb));
+    v = __builtin_bswap32(10);
+    rv = rb_txn_write(&msg, 0, &v, 4);
+    assert(!rv);
+    rb_commit(&msg, rb_txn_used(&msg));
+    assert(rb_used_size(rb) == 14);
+    rv = rb_peek_be32(rb, 0, &v);
+    assert(!rv && v == 10);
+    rv = rb_peek(rb, 4, buf1, 10);
+    assert(!rv && memcmp(buf1, "0123456789", 10) == 0);
+
+    /* committed handles are closed */
+    assert(rb_commit(&msg, 1) == -EINVAL && rb_commit(&body, 1) == -EINVAL);
+    assert(rb_txn_write(&msg, 0, "x", 1) == -EINVAL && rb_txn_peek(&msg, 0, &p) == 0);
+    assert(rb_txn_len(&msg) == 0 && rb_used_size(rb) == 14);
+
+    /* an aborted reservation leaves nothing behind */
+    rv = rb_reserve(rb, RB_SIZE - 14, &msg);
+    assert(!rv);
+    rv = rb_reserve(rb, RB_SIZE - 13, &body);
+    assert(rv == -EAGAIN);
+    rb_txn_write(&msg, 0, "garbage", 7);
+    rb_abort(&msg);
+    assert(rb_used_size(rb) == 14);
+    assert(rb_commit(&msg, 0) == -EINVAL && rb_txn_write(&msg, 0, "x", 1) == -EINVAL);
+    rb_abort(&msg);
+    rb_deinit(rb);
+
+    /* spans chunks, expanding on the way */
+    rv = rbvec_init(&rbv, 4, BUF_SIZE);
+    assert(!rv);
+    rv = rbvec_reserve(rbv, BUF_SIZE * 4 + 1, &msg);
+    assert(rv == -EINVAL);
+    rv = rbvec_reserve(rbv, BUF_SIZE * 3, &msg);
+    assert(!rv && msg.iov_cnt > 1);
+    for (i = 0; i < BUF_SIZE * 3; i++)
+        buf1[i] = (unsigned char)i;
+    rv = rb_reserve_nested(&msg, 1, BUF_SIZE * 3 - 1, &body);
+    assert(!rv);
+    rb_txn_write(&body, 0, buf1 + 1, BUF_SIZE * 2);
+    rb_commit(&body, BUF_SIZE * 2);
+    buf1[0] = 0;
+    rb_txn_write(&msg, 0, buf1, 1);
+    rb_commit(&msg, rb_txn_used(&msg));
+    assert(rbvec_used_size(rbv) == BUF_SIZE * 2 + 1);
+    memset(buf1, 0, sizeof(buf1));
+    rv = rbvec_peek(rbv, 0, buf1, BUF_SIZE * 2 + 1);
+    for (i = 0; i < BUF_SIZE * 2 + 1; i++)
+        assert(buf1[i] == (unsigned char)i);
+    rv = rbvec_reserve(rbv, BUF_SIZE, &msg);
+    assert(!rv);
+    rb_abort(&msg);
+    assert(rbvec_used_size(rbv) == BUF_SIZE * 2 + 1);
+
+    /* closing the parent closes what is nested in it, used bounds its commit */
+    rv = rbvec_reserve(rbv, 200, &msg);
+    assert(!rv);
+    rv = rb_reserve_nested(&msg, 4, 100, &body);
+    assert(!rv);
+    rv = rb_reserve_nested(&body, 0, 8, &hdr);
+    assert(!rv && rb_commit(&hdr, 8) == 0 && rb_txn_used(&body) == 8);
+    assert(rb_commit(&body, 7) == -EINVAL);
+    rv = rb_reserve_nested(&body, 8, 8, &hdr);
+    assert(!rv);
+    rb_commit(&msg, 4);
+    assert(rbvec_used_size(rbv) == BUF_SIZE * 2 + 5);
+    assert(rb_txn_write(&body, 0, "hello", 5) == -EINVAL && rb_txn_peek(&body, 0, &p) == 0);
+    assert(rb_txn_write(&hdr, 0, "hello", 5) == -EINVAL && rb_commit(&hdr, 1) == -EINVAL);
+    assert(rb_reserve_nested(&body, 0, 1, &hdr) == -EINVAL);
+    rb_abort(&body);
+    rbvec_deinit(rbv);
+
+    printf("txn done\n");
+}
+
+#define RECLAIM_SIZE        RB_MMAP_THRESHOLD
+
+static void test_reclaim()
+{
+    rb_t *rb;
+    unsigned char *buf1;
+    unsigned int page = (unsigned int)sysconf(_SC_PAGESIZE), rs, i;
+    unsigned long lo;
+    int rv;
+
+    /* below RB_MMAP_THRESHOLD: malloc'd, nothing to give back */
+    rv = rb_init(&rb, RB_SIZE);
+    assert(!rv);
+    assert(rb_reclaim(rb) == 0 && rb_resident_size(rb) == RB_SIZE);
+    assert(rb_set_reclaim(rb, 0, 100) == -EINVAL);
+    rb_deinit(rb);
+    rv = rb_init(&rb, RB_MMAP_THRESHOLD / 2);
+    assert(!rv && rb->map_size == 0);
+    rb_puts(rb, (const unsigned char *)"x", 1);
+    assert(rb_reclaim(rb) == 0);
+    rb_deinit(rb);
+
+    buf1 = (unsigned char *)malloc(RECLAIM_SIZE);
+    for (i = 0; i < RECLAIM_SIZE; i++)
+        buf1[i] = (unsigned char)i;
+    rv = rb_init(&rb, RECLAIM_SIZE);
+    assert(!rv && ((unsigned long)rb->buffer & (page - 1)) == 0);
+    rs = rb_puts(rb, buf1, RECLAIM_SIZE);
+    assert(rs == RECLAIM_SIZE && rb_resident_size(rb) == RECLAIM_SIZE);
+    assert(rb_reclaim(rb) == 0);
+
+    /* live data survives, only whole pages outside it go */
+    rb_gets(rb, buf1, page * 3 + 100);
+    rs = rb_reclaim(rb);
+    assert(rs == page * 3);
+    assert(rb_resident_size(rb) == RECLAIM_SIZE - page * 3);
+    rs = rb_gets(rb, buf1, RECLAIM_SIZE);
+    assert(rs == RECLAIM_SIZE - page * 3 - 100);
+    for (i = 0; i < rs; i++)
+        assert(buf1[i] == (unsigned char)(i + page * 3 + 100));
+
+    /* idle for a period at or below low */
+    rv = rb_set_reclaim(rb, 16, 100);
+    assert(!rv);
+    rb_puts(rb, buf1, page * 4);
+    assert(rb_reclaim_tick(rb, 1000) == 0);
+    rb_gets(rb, buf1, page * 4);
+    assert(rb_reclaim_tick(rb, 1050) == 0);
+    assert(rb_reclaim_tick(rb, 1149) == 0);
+    assert(rb_reclaim_tick(rb, 1150) > 0 && rb_resident_size(rb) == 0);
+    rb_puts(rb, buf1, 8);
+    assert(rb_reclaim_tick(rb, 1200) == 0);
+    assert(rb_reclaim_tick(rb, 1250) > 0 && rb_resident_size(rb) == page);
+
+    /* rb_reinit drops everything */
+    rb_clear_reclaim(rb);
+    rb_puts(rb, buf1, RECLAIM_SIZE);
+    rb_reinit(rb);
+    assert(rb_is_empty(rb) && rb_resident_size(rb) == 0 && rb_size(rb) == RECLAIM_SIZE);
+    rb_deinit(rb);
+
+    /* memfd: the buffer follows the header, only the pages wholly inside it are punched out */
+    rv = rb_init_memfd(&rb, RECLAIM_SIZE);
+    assert(!rv && ((unsigned long)rb->buffer & (page - 1)) != 0);
+    lo = (unsigned long)rb->buffer;
+    for (i = 0; i < RECLAIM_SIZE; i++)
+        buf1[i] = (unsigned char)(i + 1);
+    rb_puts(rb, buf1, RECLAIM_SIZE);
+    assert(rb_reclaim(rb) == 0 && rb_resident_size(rb) == RECLAIM_SIZE);
+    rb_gets(rb, buf1, page * 3 + 100);
+    rs = rb_reclaim(rb);
+    assert(rs == ((lo + page * 3 + 100) & ~(page - 1UL)) - ((lo + page - 1) & ~(page - 1UL)));
+    assert(rb_resident_size(rb) == RECLAIM_SIZE - rs);
+    assert(rb->buffer[page * 2] == 0 && rb->buffer[page * 3 + 100] != 0);
+    rs = rb_gets(rb, buf1, RECLAIM_SIZE);
+    assert(rs == RECLAIM_SIZE - page * 3 - 100);
+    for (i = 0; i < rs; i++)
+        assert(buf1[i] == (unsigned char)(i + page * 3 + 101));
+    rs = rb_reclaim(rb);
+    assert(rs == ((lo + RECLAIM_SIZE) & ~(page - 1UL)) - ((lo + page - 1) & ~(page - 1UL)));
+    assert(rb_resident_size(rb) == RECLAIM_SIZE - rs);
+    rb_deinit(rb);
+    free(buf1);
+
+    printf("reclaim done\n");
+}
+
+static void test_handoff()
+{
+    rb_t *rb;
+    rbvec_t *rbv;
+    rbvec_policy_t policy = { RBVEC_MEMFD | RBVEC_LAZY, 1, 0, 0 };
+    int rv, sv[2], fds[2];
+    unsigned int rs, fd_cnt, size, i;
+    unsigned char buf1[LARGE_BUF_SIZE], buf2[LARGE_BUF_SIZE];
+    char tag[16];
+    rbvec_t hdr, bad;
+
+    for (i = 0; i < LARGE_BUF_SIZE; i++)
+        buf1[i] = (unsigned char)i;
+    rv = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(!rv);
+
+    rv = rb_init_memfd(&rb, RB_SIZE);
+    assert(!rv && rb_fd(rb) >= 0);
+    rs = rb_puts(rb, buf1, RB_SIZE - BUF_SIZE);
+    rs = rb_gets(rb, buf2, RB_SIZE - BUF_SIZE);
+    rs = rb_puts(rb, buf1, RB_SIZE - 1);
+    assert(rs == RB_SIZE - 1);
+
+    /* 64 chunk slots, growing chunks, out is not at slot 0 when it expands */
+    rv = rbvec_init_policy(&rbv, 64, 64, &policy);
+    assert(!rv && rbvec_fd(rbv) >= 0);
+    rs = rbvec_puts(rbv, buf1, 100);
+    rs = rbvec_gets(rbv, buf2, 70);
+    rs = rbvec_puts(rbv, buf1 + 100, 3000);
+    assert(rs == 3000);
+
+    /* old process */
+    fds[0] = rb_detach(rb);
+    fds[1] = rbvec_detach(rbv);
+    rv = rbhandoff_send(sv[0], fds, 2, "rb,rbvec", 9);
+    assert(!rv);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* new process */
+    fd_cnt = 2;
+    size = sizeof(tag);
+    rv = rbhandoff_recv(sv[1], fds, &fd_cnt, tag, &size);
+    assert(!rv && fd_cnt == 2 && size == 9 && strcmp(tag, "rb,rbvec") == 0);
+    rv = rb_attach(&rb, fds[0]);
+    assert(!rv && rb_used_size(rb) == RB_SIZE - 1 && rb->wm == NULL);
+    rs = rb_gets(rb, buf2, RB_SIZE);
+    assert(rs == RB_SIZE - 1 && memcmp(buf1, buf2, rs) == 0);
+    rb_deinit(rb);
+    rv = rbvec_attach(&rbv, fds[1]);
+    assert(!rv && rbvec_used_size(rbv) == 3030);
+    rs = rbvec_gets(rbv, buf2, LARGE_BUF_SIZE);
+    assert(rs == 3030 && memcmp(buf1 + 70, buf2, rs) == 0);
+    rs = rbvec_puts(rbv, buf1, 5000);
+    assert(rs == 5000);
+    rs = rbvec_gets(rbv, buf2, LARGE_BUF_SIZE);
+    assert(rs == 5000 && memcmp(buf1, buf2, rs) == 0);
+    rbvec_deinit(rbv);
+
+    /* eager chunks come from the mapping too */
+    policy.flags = RBVEC_MEMFD;
+    rv = rbvec_init_policy(&rbv, 8, 64, &policy);
+    assert(!rv);
+    rs = rbvec_puts(rbv, buf1, 1000);
+    assert(rs == 1000);
+    fds[1] = rbvec_detach(rbv);
+
+    /* a header that does not add up is refused, the fd stays usable */
+    assert(pread(fds[1], &hdr, sizeof(hdr), 0) == sizeof(hdr));
+    bad = hdr;
+    bad.used++;
+    assert(pwrite(fds[1], &bad, sizeof(bad), 0) == sizeof(bad) && rbvec_attach(&rbv, fds[1]) == -EINVAL);
+    bad = hdr;
+    bad.out = UINT_MAX - 1;
+    bad.in = bad.out + rbvec_used_num(&hdr);
+    assert(pwrite(fds[1], &bad, sizeof(bad), 0) == sizeof(bad) && rbvec_attach(&rbv, fds[1]) == -EINVAL);
+    bad = hdr;
+    bad.chunk_size >>= 1;
+    assert(pwrite(fds[1], &bad, sizeof(bad), 0) == sizeof(bad) && rbvec_attach(&rbv, fds[1]) == -EINVAL);
+    bad = hdr;
+    bad.in = bad.out;
+    assert(pwrite(fds[1], &bad, sizeof(bad), 0) == sizeof(bad) && rbvec_attach(&rbv, fds[1]) == -EINVAL);
+    assert(pwrite(fds[1], &hdr, sizeof(hdr), 0) == sizeof(hdr));
+    rv = rbvec_attach(&rbv, fds[1]);
+    assert(!rv);
+    rs = rbvec_gets(rbv, buf2, LARGE_BUF_SIZE);
+    assert(rs == 1000 && memcmp(buf1, buf2, rs) == 0);
+    rbvec_deinit(rbv);
+
+    /* not a memfd buffer */
+    rv = rb_init(&rb, RB_SIZE);
+    assert(rb_detach(rb) == -EINVAL);
+    rb_deinit(rb);
+    rv = rb_init_memfd(&rb, RB_SIZE);
+    fds[0] = rb_detach(rb);
+    rv = rbvec_attach(&rbv, fds[0]);
+    assert(rv == -EINVAL);
+    rv = rb_attach(&rb, fds[0]);
+    assert(!rv);
+    rb_deinit(rb);
+
+    close(sv[0]);
+    close(sv[1]);
+
+    printf("handoff done\n");
+}
+
+#define SHARD_NUM           4
+#define SHARD_SIZE          1024
+
+static void test_rbshard()
+{
+    rbshard_t *rbs;
+    rbshard_stats_t st;
+    int rv, i, rs;
+    unsigned char buf1[BUF_SIZE], batch[SHARD_SIZE];
+    const unsigned char *rec;
+
+    rv = rbshard_init(&rbs, SHARD_NUM, SHARD_SIZE);
+    assert(!rv);
+    assert(rbshard_num(rbs) == SHARD_NUM);
+    assert(rbshard_local(rbs) < SHARD_NUM);
+    assert(rbshard_used_size(rbs) == 0);
+
+    memset(buf1, 'S', BUF_SIZE);
+    for (i = 0; i < 3; i++) {
+        rv = rbshard_put(rbs, 0, buf1, BUF_SIZE - i);
+        assert(!rv);
+    }
+    rv = rbshard_put(rbs, 1, buf1, 7);
+    assert(!rv);
+    assert(rbshard_used_size(rbs) == rbshard_rec_size(BUF_SIZE) + rbshard_rec_size(BUF_SIZE - 1) + rbshard_rec_size(BUF_SIZE - 2) + rbshard_rec_size(7));
+
+    /* own shard first */
+    rs = rbshard_gets(rbs, 1, batch, SHARD_SIZE);
+    assert(rs == (int)rbshard_rec_size(7));
+    assert(rbshard_rec_len(batch) == 7 && memcmp(rbshard_rec_data(batch), buf1, 7) == 0);
+
+    /* then steal whole records from the fullest shard */
+    rbshard_set_steal_size(rbs, rbshard_rec_size(BUF_SIZE) * 2);
+    rs = rbshard_gets(rbs, 1, batch, SHARD_SIZE);
+    assert(rs == (int)(rbshard_rec_size(BUF_SIZE) + rbshard_rec_size(BUF_SIZE - 1)));
+    rec = batch;
+    assert(rbshard_rec_len(rec) == BUF_SIZE);
+    rec = rbshard_rec_next(rec);
+    assert(rbshard_rec_len(rec) == BUF_SIZE - 1);
+    assert(memcmp(rbshard_rec_data(rec), buf1, BUF_SIZE - 1) == 0);
+
+    rs = rbshard_gets(rbs, 0, batch, SHARD_SIZE);
+    assert(rs == (int)rbshard_rec_size(BUF_SIZE - 2));
+    assert(rbshard_used_size(rbs) == 0);
+    rs = rbshard_gets(rbs, 2, batch, SHARD_SIZE);
+    assert(rs == 0);
+
+    /* a head record larger than steal_size is skipped, not a dead end */
+    rv = rbshard_put(rbs, 0, buf1, BUF_SIZE);
+    assert(!rv);
+    rv = rbshard_put(rbs, 2, buf1, 7);
+    assert(!rv);
+    rbshard_set_steal_size(rbs, rbshard_rec_size(16));
+    rs = rbshard_gets(rbs, 1, batch, SHARD_SIZE);
+    assert(rs == (int)rbshard_rec_size(7));
+    rs = rbshard_gets(rbs, 1, batch, SHARD_SIZE);
+    assert(rs == 0);
+    rs = rbshard_gets(rbs, 0, batch, rbshard_rec_size(16));
+    assert(rs == -EMSGSIZE);
+    rs = rbshard_gets(rbs, 0, batch, SHARD_SIZE);
+    assert(rs == (int)rbshard_rec_size(BUF_SIZE));
+    assert(rbshard_used_size(rbs) == 0);
+
+    rv = rbshard_put(rbs, 3, buf1, UINT_MAX - 1);
+    assert(rv == -EMSGSIZE);
+    rv = rbshard_put(rbs, 3, buf1, SHARD_SIZE - RBSHARD_HDR_SIZE + 1);
+    assert(rv == -EMSGSIZE && rbshard_used_size(rbs) == 0);
+
+    for (i = 0; rbshard_put(rbs, 3, buf1, BUF_SIZE) == 0; i++)
+        ;
+    assert(i == SHARD_SIZE / rbshard_rec_size(BUF_SIZE));
+
+    rbshard_stats(rbs, &st);
+    assert(st.puts == 6 + (unsigned int)i && st.put_fails == 1);
+    assert(st.gets == 5 && st.steals == 2);
+    assert(st.stolen_bytes == rbshard_rec_size(BUF_SIZE) * 2 + rbshard_rec_size(7));
+    assert(rbshard_fairness(rbs) > 0 && rbshard_fairness(rbs) <= 1.0);
+
+    rbshard_deinit(rbs);
+
+    printf("rbshard done\n");
+}
+
+static void reactor_echo(rbconn_t *c)
+{
+    unsigned char buf[BUF_SIZE];
+    unsigned int s;
+
+    while ((s = rb_gets(c->rbuf.rb, buf, BUF_SIZE)) != 0)
+        rbreactor_puts(c, buf, s);
+}
+
+static void reactor_closed(rbconn_t *c)
+{
+    (*(int *)c->data)++;
+}
+
+static void test_rbreactor()
+{
+    rbreactor_t *r;
+    rbconn_t *c;
+    int rv, sv[2], closed = 0;
+    unsigned char buf1[BUF_SIZE], buf2[BUF_SIZE], big[RB_SIZE * 4];
+
+    rv = rbreactor_init(&r, 16);
+    assert(!rv);
+    rv = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(!rv);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    rv = rbreactor_add(r, sv[0], RB_SIZE, RB_SIZE, reactor_echo, reactor_closed, &closed, &c);
+    assert(!rv && rbreactor_conn_num(r) == 1);
+    assert(!(c->events & EPOLLOUT));
+
+    memset(buf1, 'R', BUF_SIZE);
+    rv = write(sv[1], buf1, BUF_SIZE);
+    assert(rv == BUF_SIZE);
+    rv = rbreactor_poll(r, 1000);
+    assert(rv == 1);
+    assert(rbconn_used_size(c, rbuf) == 0 && rbconn_used_size(c, wbuf) == 0);
+    assert(!(c->events & EPOLLOUT));
+    rv = read(sv[1], buf2, BUF_SIZE);
+    assert(rv == BUF_SIZE && memcmp(buf1, buf2, BUF_SIZE) == 0);
+
+    /* a burst larger than the read buffer is not an EOF */
+    memset(big, 'S', sizeof(big));
+    rv = write(sv[1], big, sizeof(big));
+    assert(rv == sizeof(big));
+    rv = rbreactor_poll(r, 1000);
+    assert(rv == 1 && closed == 0 && rbreactor_conn_num(r) == 1);
+    while (recv(sv[1], big, sizeof(big), MSG_DONTWAIT) > 0)
+        ;
+
+    close(sv[1]);
+    rv = rbreactor_poll(r, 1000);
+    assert(rv == 1 && closed == 1 && rbreactor_conn_num(r) == 0);
+
+    rbreactor_deinit(r);
+
+    printf("rbreactor done\n");
+}
+
 /*
 int read_cb(void *ptr, void *buf, int size)
 {
@@ -376,3 +1153,312 @@ int write_cb(void *ptr, const const *buf, int size)
     return size;
 }
 */
+
+#define EV_MSGS             100000
+
+static void *ev_producer(void *ptr)
+{
+    rbev_t *ev = (rbev_t *)ptr;
+    unsigned int i, rs;
+
+    for (i = 0; i < EV_MSGS; i++) {
+        do {
+            rs = rbev_puts(ev, (unsigned char *)&i, sizeof(i));
+        } while (!rs);
+        assert(rs == sizeof(i));
+    }
+    while (!rb_is_empty(rbev_rb(ev)))
+        rbev_flush(ev);
+
+    return NULL;
+}
+
+static void test_rbev()
+{
+    rbev_t *ev;
+    pthread_t tid;
+    struct epoll_event e;
+    uint64_t cnt;
+    int rv, epfd;
+    unsigned int rs, i, next = 0;
+    unsigned char buf1[BUF_SIZE];
+
+    rv = rbev_init(&ev, RB_SIZE, RB_SIZE * 2);
+    assert(rv == -EINVAL);
+
+    /* empty to non-empty signals once */
+    rv = rbev_init(&ev, RB_SIZE, 0);
+    assert(!rv);
+    memset(buf1, 'E', BUF_SIZE);
+    rs = rbev_puts(ev, buf1, 10);
+    rs = rbev_puts(ev, buf1, 10);
+    assert(rs == 10 && rbev_signals(ev) == 1);
+    rv = rbev_arm(ev);
+    assert(rv == 1);
+    rs = rbev_gets(ev, buf1, BUF_SIZE);
+    assert(rs == 20);
+    rv = rbev_arm(ev);
+    assert(rv == 0 && read(rbev_fd(ev), &cnt, sizeof(cnt)) < 0 && errno == EAGAIN);
+    rs = rbev_puts(ev, buf1, 10);
+    assert(rbev_signals(ev) == 2);
+    rv = rbev_flush(ev);
+    assert(rv == 0 && rbev_signals(ev) == 2);
+    rbev_deinit(ev);
+
+    /* the consumer re-arms between the producer taking armed and writing the eventfd */
+    rv = rbev_init(&ev, RB_SIZE, 0);
+    assert(!rv);
+    rb_produced(rbev_rb(ev), 10);
+    assert(__atomic_exchange_n(&ev->armed, 0, __ATOMIC_SEQ_CST) == 1);
+    rs = rbev_gets(ev, buf1, BUF_SIZE);
+    assert(rs == 10);
+    rv = rbev_arm(ev);
+    assert(rv == 0 && !ev->armed);
+    cnt = 1;
+    assert(write(rbev_fd(ev), &cnt, sizeof(cnt)) == sizeof(cnt));
+    rv = rbev_arm(ev);
+    assert(rv == 0 && ev->armed && read(rbev_fd(ev), &cnt, sizeof(cnt)) < 0 && errno == EAGAIN);
+    rbev_deinit(ev);
+
+    /* nothing until the batch is there, unless flushed */
+    rv = rbev_init(&ev, RB_SIZE, 64);
+    assert(!rv);
+    rs = rbev_puts(ev, buf1, 40);
+    assert(rbev_signals(ev) == 0);
+    rv = rbev_arm(ev);
+    assert(rv == 0);
+    rs = rbev_puts(ev, buf1, 40);
+    assert(rbev_signals(ev) == 1);
+    rs = rbev_gets(ev, buf1, BUF_SIZE);
+    rv = rbev_arm(ev);
+    assert(rv == 0);
+    rs = rbev_puts(ev, buf1, 1);
+    rv = rbev_flush(ev);
+    assert(rv == 1 && rbev_signals(ev) == 2);
+    rbev_deinit(ev);
+
+    /* a producer thread and an epoll loop */
+    rv = rbev_init(&ev, RB_SIZE, 64);
+    assert(!rv);
+    epfd = epoll_create1(0);
+    e.events = EPOLLIN;
+    e.data.ptr = ev;
+    rv = epoll_ctl(epfd, EPOLL_CTL_ADD, rbev_fd(ev), &e);
+    assert(!rv);
+    pthread_create(&tid, NULL, ev_producer, ev);
+    while (next < EV_MSGS) {
+        do {
+            while ((rs = rbev_gets(ev, buf1, BUF_SIZE - BUF_SIZE % sizeof(next)))) {
+                assert(rs % sizeof(next) == 0);
+                for (i = 0; i < rs; i += sizeof(next), next++)
+                    assert(memcmp(buf1 + i, &next, sizeof(next)) == 0);
+            }
+        } while (rbev_arm(ev));
+        if (next < EV_MSGS) {
+            rv = epoll_wait(epfd, &e, 1, 1000);
+            assert(rv == 1);
+        }
+    }
+    pthread_join(tid, NULL);
+    assert(rbev_signals(ev) < EV_MSGS);
+    close(epfd);
+    rbev_deinit(ev);
+
+    printf("rbev done\n");
+}
+
+#define MP_THREADS          4
+#define MP_MSGS             20000
+
+/* every entry is len, thread, seq and len - 12 bytes of padding */
+static void *mp_producer(void *ptr)
+{
+    rbmp_t *mp = ((void **)ptr)[0];
+    unsigned int id = (unsigned int)(size_t)((void **)ptr)[1];
+    unsigned int ent[BUF_SIZE / 4], i, len;
+
+    for (i = 0; i < MP_MSGS; i++) {
+        len = 12 + (i % 8) * 4;
+        ent[0] = len;
+        ent[1] = id;
+        ent[2] = i;
+        while (!rbmp_puts(mp, (unsigned char *)ent, len))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_rbmp()
+{
+    rbmp_t *mp;
+    rbmp_rsv_t r1, r2, r3;
+    pthread_t tid[MP_THREADS];
+    void *args[MP_THREADS][2];
+    int rv, i;
+    unsigned int rs, len, got = 0, next[MP_THREADS];
+    unsigned char buf1[RB_SIZE];
+    unsigned int ent[BUF_SIZE / 4];
+
+    rv = rbmp_init(&mp, RB_SIZE, 3);
+    assert(rv == -EINVAL);
+    rv = rbmp_init(&mp, RB_SIZE, 2);
+    assert(!rv);
+
+    /* out of order commits, the prefix moves only when the first one lands */
+    memset(buf1, 0, RB_SIZE);
+    rs = rbmp_puts(mp, buf1, RB_SIZE - 100);
+    rs = rbmp_gets(mp, buf1, RB_SIZE);
+    assert(rs == RB_SIZE - 100);
+    rv = rbmp_reserve(mp, 60, &r1);
+    assert(!rv && r1.iov_cnt == 1);
+    rv = rbmp_reserve(mp, 60, &r2);
+    assert(!rv && r2.iov_cnt == 2 && r2.iov[0].iov_len == 40 && r2.iov[1].iov_len == 20);
+    rv = rbmp_reserve(mp, 1, &r3);
+    assert(rv == -EAGAIN);
+    memset(r2.iov[0].iov_base, 'B', r2.iov[0].iov_len);
+    memset(r2.iov[1].iov_base, 'B', r2.iov[1].iov_len);
+    rbmp_commit(mp, &r2);
+    assert(rbmp_sync(mp) == 0);
+    memset(r1.iov[0].iov_base, 'A', 60);
+    rbmp_commit(mp, &r1);
+    assert(rbmp_sync(mp) == 120);
+    rv = rb_peek(rbmp_rb(mp), 59, buf1, 2);
+    assert(!rv && buf1[0] == 'A' && buf1[1] == 'B');
+    rs = rbmp_gets(mp, buf1, RB_SIZE);
+    assert(rs == 120);
+    rv = rbmp_reserve(mp, RB_SIZE, &r1);
+    assert(!rv);
+    rv = rbmp_reserve(mp, 1, &r2);
+    assert(rv == -EAGAIN);
+    rbmp_commit(mp, &r1);
+    rs = rbmp_gets(mp, buf1, RB_SIZE);
+    assert(rs == RB_SIZE);
+    rbmp_deinit(mp);
+
+    /* producers racing, each one's entries stay in its own order */
+    rv = rbmp_init(&mp, RB_SIZE * 4, 16);
+    assert(!rv);
+    for (i = 0; i < MP_THREADS; i++) {
+        args[i][0] = mp;
+        args[i][1] = (void *)(size_t)i;
+        next[i] = 0;
+        pthread_create(&tid[i], NULL, mp_producer, args[i]);
+    }
+    while (got < MP_THREADS * MP_MSGS) {
+        if (rbmp_sync(mp) < 4 || rb_peek(rbmp_rb(mp), 0, &len, 4) < 0 || rb_used_size(rbmp_rb(mp)) < len) {
+            sched_yield();
+            continue;
+        }
+        rs = rbmp_gets(mp, (unsigned char *)ent, len);
+        assert(rs == len && ent[1] < MP_THREADS && ent[2] == next[ent[1]]);
+        assert(len == 12 + (ent[2] % 8) * 4);
+        next[ent[1]]++;
+        got++;
+    }
+    for (i = 0; i < MP_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+        assert(next[i] == MP_MSGS);
+    }
+    assert(rbmp_sync(mp) == 0);
+    rbmp_deinit(mp);
+
+    printf("rbmp done\n");
+}
+
+/* takes at most cap bytes per call, like a socket with a small send buffer */
+typedef struct lane_sink_t{
+    unsigned char buf[LARGE_BUF_SIZE];
+    unsigned int len;
+    unsigned int cap;
+    unsigned int calls;
+} lane_sink_t;
+
+static int lane_writev(void *ptr, const void *buf, unsigned int cnt)
+{
+    lane_sink_t *sink = (lane_sink_t *)ptr;
+    const struct iovec *iov = (const struct iovec *)buf;
+    unsigned int i, s, n = 0;
+
+    sink->calls++;
+    for (i = 0; i < cnt && n < sink->cap; i++) {
+        s = iov[i].iov_len < sink->cap - n ? iov[i].iov_len : sink->cap - n;
+        memcpy(sink->buf + sink->len, iov[i].iov_base, s);
+        sink->len += s;
+        n += s;
+    }
+
+    return n ? (int)n : -EAGAIN;
+}
+
+static void test_rblane()
+{
+    rblane_t *rbl;
+    lane_sink_t sink;
+    unsigned char buf1[RB_SIZE];
+    unsigned int wrote, i;
+    int rv;
+
+    rv = rblane_init(&rbl, 3, RB_SIZE);
+    assert(!rv);
+    rv = rblane_set_quantum(rbl, 3, 100);
+    assert(rv == -EINVAL);
+    rblane_set_quantum(rbl, 1, 100);
+    rblane_set_quantum(rbl, 2, 300);
+    rv = rblane_puts(rbl, 1, buf1, RB_SIZE + 1);
+    assert(rv == -EINVAL);
+
+    /* a half written bulk message is finished before the control one */
+    memset(&sink, 0, sizeof(sink));
+    memset(buf1, 'a', 200);
+    rv = rblane_puts(rbl, 1, buf1, 200);
+    assert(!rv);
+    rv = rblane_puts(rbl, 1, buf1, RB_SIZE - 199);
+    assert(rv == -EAGAIN);
+    sink.cap = 50;
+    wrote = 0;
+    rv = rblane_write(rbl, lane_writev, &sink, &wrote);
+    assert(rv == 50 && wrote == 50 && rbl->cur == 1);
+    rv = rblane_puts(rbl, 0, (const unsigned char *)"CTRL", 4);
+    assert(!rv);
+    rv = rblane_puts(rbl, 2, buf1, 10);
+    assert(!rv);
+    sink.cap = LARGE_BUF_SIZE;
+    rv = rblane_write(rbl, lane_writev, &sink, &wrote);
+    assert(wrote == 214 && sink.len == 214 && rblane_used_size(rbl) == 0);
+    assert(sink.buf[199] == 'a' && memcmp(sink.buf + 200, "CTRL", 4) == 0);
+
+    /* strict lane first, whatever was queued before it */
+    sink.len = 0;
+    memset(buf1, 'b', 10);
+    rblane_puts(rbl, 1, buf1, 10);
+    rblane_puts(rbl, 0, (const unsigned char *)"C", 1);
+    rv = rblane_write(rbl, lane_writev, &sink, &wrote);
+    assert(sink.len == 11 && sink.buf[0] == 'C' && sink.buf[1] == 'b');
+    rblane_deinit(rbl);
+
+    /* 100 bytes a round for lane 1, 300 for lane 2, one message per write */
+    rv = rblane_init(&rbl, 3, RB_SIZE);
+    assert(!rv);
+    rblane_set_quantum(rbl, 1, 100);
+    rblane_set_quantum(rbl, 2, 300);
+    for (i = 0; i < 4; i++) {
+        memset(buf1, 'x', 100);
+        assert(rblane_puts(rbl, 1, buf1, 100) == 0);
+        memset(buf1, 'y', 100);
+        assert(rblane_puts(rbl, 2, buf1, 100) == 0);
+    }
+    memset(&sink, 0, sizeof(sink));
+    sink.cap = 100;
+    while (rblane_used_size(rbl)) {
+        wrote = 0;
+        rv = rblane_write(rbl, lane_writev, &sink, &wrote);
+        assert(wrote == 100 && (rv == 100 || (rv == 0 && !rblane_used_size(rbl))));
+    }
+    for (i = 0; i < 8; i++)
+        buf1[i] = sink.buf[i * 100];
+    assert(memcmp(buf1, "xyyyxyxx", 8) == 0 && sink.calls == 8);
+    rblane_deinit(rbl);
+
+    printf("rblane done\n");
+}
@@ -0,0 +1,209 @@
+#include "ringbuffer.hpp"
+#include "ringbuffer_co.hpp"
+#include "assert.h"
+#include "string.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include <coroutine>
+#include <memory>
+#include <string>
+
+static void test_ringbuffer();
+static void test_byte_ring();
+static void test_async_ring();
+
+int main()
+{
+    test_ringbuffer();
+    test_byte_ring();
+    test_async_ring();
+
+    return 0;
+}
+
+#define RING_SIZE           8
+
+/* counts live copies, copying or assigning the value -1 throws */
+struct counted {
+    static int live;
+    int v;
+
+    counted(int x = 0) : v(x) { live++; }
+    counted(const counted &o) : v(o.v)
+    {
+        if (o.v < 0)
+            throw o.v;
+        live++;
+    }
+    counted &operator=(const counted &o)
+    {
+        if (o.v < 0)
+            throw o.v;
+        v = o.v;
+        return *this;
+    }
+    ~counted() { live--; }
+};
+int counted::live;
+
+static void test_ringbuffer()
+{
+    rb::ringbuffer<int, RING_SIZE> ring;
+    rb::ringbuffer<std::unique_ptr<std::string>, RING_SIZE> owners;
+    std::unique_ptr<std::string> p;
+    int buf1[RING_SIZE], buf2[RING_SIZE];
+    unsigned int rs, i;
+
+    static_assert(decltype(ring)::mask == RING_SIZE - 1);
+    static_assert(decltype(ring)::size() == RING_SIZE);
+    assert(ring.empty() && !ring.full());
+
+    for (i = 0; i < RING_SIZE; i++)
+        buf1[i] = (int)i;
+    rs = ring.puts(buf1, 6);
+    assert(rs == 6 && ring.used_size() == 6);
+    rs = ring.gets(buf2, 4);
+    assert(rs == 4 && memcmp(buf1, buf2, sizeof(int) * 4) == 0);
+
+    /* 2 elements left at the tail, 6 more wrap to the head */
+    rs = ring.puts(buf1, RING_SIZE);
+    assert(rs == 6 && ring.full() && ring.avail_size() == 0);
+    auto r = ring.consumer_peek(RING_SIZE);
+    assert(r.size() == RING_SIZE && r.first.size() == 4 && r.second.size() == 4);
+    assert(r.first[0] == 4 && r.first[2] == 0 && r.second[3] == 5);
+    r = ring.consumer_peek_at(5, RING_SIZE);
+    assert(r.size() == 3 && r.second.empty() && r.first[0] == 3);
+    ring.consumed(RING_SIZE);
+    assert(ring.empty());
+
+    auto w = ring.producer_peek(RING_SIZE);
+    assert(w.first.size() == 4 && w.second.size() == 4);
+    w.first[0] = 42;
+    ring.produced(1);
+    assert(ring.front() == 42);
+
+    assert(owners.emplace(std::make_unique<std::string>("ring")));
+    assert(owners.push(std::make_unique<std::string>("buffer")));
+    assert(owners.pop(p) && *p == "ring");
+    assert(owners.pop(p) && *p == "buffer");
+    assert(!owners.pop(p) && owners.empty());
+    for (i = 0; i < RING_SIZE; i++)
+        assert(owners.emplace(std::make_unique<std::string>("x")));
+    assert(!owners.emplace(std::make_unique<std::string>("full")));
+
+    /* a throw in the wrapped part of puts leaves nothing constructed behind */
+    {
+        rb::ringbuffer<counted, RING_SIZE> cring;
+        counted src[RING_SIZE], dst[RING_SIZE];
+        int base;
+
+        assert(cring.puts(src, 6) == 6 && cring.gets(dst, 6) == 6);
+        base = counted::live;
+        src[3].v = -1;
+        try {
+            cring.puts(src, RING_SIZE);
+            assert(0);
+        } catch (int) {
+        }
+        assert(counted::live == base && cring.empty());
+
+        /* nor does a throw in gets destroy anything twice */
+        src[3].v = 3;
+        assert(cring.puts(src, RING_SIZE) == RING_SIZE);
+        base = counted::live;
+        cring.consumer_peek_at(3, 1).first[0].v = -1;
+        try {
+            cring.gets(dst, RING_SIZE);
+            assert(0);
+        } catch (int) {
+        }
+        assert(cring.used_size() == RING_SIZE - 3 && counted::live == base - 3);
+        cring.consumed(cring.used_size());
+        assert(counted::live == base - RING_SIZE);
+    }
+
+    printf("ringbuffer done\n");
+}
+
+static void test_byte_ring()
+{
+    rb::byte_ring<512> ring;
+    unsigned int n;
+    int rv;
+
+    n = 0;
+    rv = ring.read([](unsigned char *buf, unsigned int size) {
+        memset(buf, 'B', size);
+        return (int)size;
+    }, n);
+    assert(rv == 0 && n == 512 && ring.full());
+
+    n = 0;
+    rv = ring.write([](const unsigned char *buf, unsigned int size) {
+        assert(buf[0] == 'B' && buf[size - 1] == 'B');
+        return (int)(size > 100 ? 100 : size);
+    }, n);
+    assert(rv == 100 && n == 100 && ring.used_size() == 412);
+
+    printf("byte_ring done\n");
+}
+
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+};
+
+#define CO_RB_SIZE          64
+#define CO_MSG_SIZE         24
+#define CO_MSG_NUM          10
+
+static task co_producer(rb::async_ring<> &ring, int &done)
+{
+    unsigned char msg[CO_MSG_SIZE];
+
+    for (int i = 0; i < CO_MSG_NUM; i++) {
+        co_await ring.writable(CO_MSG_SIZE);
+        memset(msg, 'a' + i, CO_MSG_SIZE);
+        assert(ring.puts(msg, CO_MSG_SIZE) == CO_MSG_SIZE);
+    }
+    done++;
+}
+
+static task co_consumer(rb::async_ring<> &ring, int &done)
+{
+    unsigned char msg[CO_MSG_SIZE];
+
+    for (int i = 0; i < CO_MSG_NUM; i++) {
+        co_await ring.readable(CO_MSG_SIZE);
+        assert(ring.gets(msg, CO_MSG_SIZE) == CO_MSG_SIZE);
+        assert(msg[0] == 'a' + i && msg[CO_MSG_SIZE - 1] == 'a' + i);
+    }
+    done++;
+}
+
+static void test_async_ring()
+{
+    rb_t *rb;
+    int rv, done = 0;
+
+    rv = rb_init(&rb, CO_RB_SIZE);
+    assert(!rv);
+    {
+        rb::async_ring<> ring(rb);
+
+        /* the consumer suspends first, the producer fills the ring and suspends in turn */
+        co_consumer(ring, done);
+        assert(done == 0);
+        co_producer(ring, done);
+        assert(done == 2);
+        assert(rb_is_empty(rb));
+    }
+    rb_deinit(rb);
+
+    printf("async_ring done\n");
+}